@@ -0,0 +1,302 @@
+#ifndef AGGREGATE_AVLBST_H
+#define AGGREGATE_AVLBST_H
+
+#include "avlbst.h"
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <type_traits>
+
+/*
+ * A Monoid tells an AggregateAVLTree what to keep in its nodes. It needs:
+ *   typedef ... value_type;
+ *   static value_type identity();
+ *   static value_type combine(const value_type& a, const value_type& b);
+ *   static value_type lift(const Key& key, const Value& value);
+ * combine must be associative, and identity() its neutral element. It is
+ * always called with its arguments in key order, so it doesn't have to be
+ * commutative.
+ */
+
+/**
+ * Sums the values.
+ */
+template <typename T> struct SumAggregate {
+    typedef T value_type;
+    static T identity() { return T(); }
+    static T combine(const T& a, const T& b) { return a + b; }
+    template <typename Key, typename Value>
+    static T lift(const Key& key, const Value& value) {
+        return value;
+    }
+};
+
+/**
+ * Finds the smallest value. The identity is the largest T.
+ */
+template <typename T> struct MinAggregate {
+    typedef T value_type;
+    static T identity() { return std::numeric_limits<T>::max(); }
+    static T combine(const T& a, const T& b) { return std::min(a, b); }
+    template <typename Key, typename Value>
+    static T lift(const Key& key, const Value& value) {
+        return value;
+    }
+};
+
+/**
+ * Finds the largest value. The identity is the smallest T.
+ */
+template <typename T> struct MaxAggregate {
+    typedef T value_type;
+    static T identity() { return std::numeric_limits<T>::lowest(); }
+    static T combine(const T& a, const T& b) { return std::max(a, b); }
+    template <typename Key, typename Value>
+    static T lift(const Key& key, const Value& value) {
+        return value;
+    }
+};
+
+/**
+ * An AVLNode that also holds the aggregate of its subtree.
+ */
+template <typename Key, typename Value, typename Monoid>
+class AggregateNode : public AVLNode<Key, Value> {
+  public:
+    typedef typename Monoid::value_type Aggregate;
+
+    AggregateNode(const Key& key, const Value& value,
+                  AggregateNode<Key, Value, Monoid>* parent);
+    AggregateNode(ItemMaker<Key, Value>& maker,
+                  AggregateNode<Key, Value, Monoid>* parent);
+
+    const Aggregate& getAggregate() const;
+    void setAggregate(const Aggregate& aggregate);
+
+    AggregateNode<Key, Value, Monoid>* getParent() const;
+    AggregateNode<Key, Value, Monoid>* getLeft() const;
+    AggregateNode<Key, Value, Monoid>* getRight() const;
+
+  protected:
+    Aggregate aggregate_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the AggregateNode class.
+  ---------------------------------------------------
+*/
+
+/**
+ * A new node is a leaf, so its aggregate is just its own item.
+ */
+template <typename Key, typename Value, typename Monoid>
+AggregateNode<Key, Value, Monoid>::AggregateNode(
+    const Key& key, const Value& value,
+    AggregateNode<Key, Value, Monoid>* parent)
+    : AVLNode<Key, Value>(key, value, parent),
+      aggregate_(Monoid::lift(key, value)) {}
+
+template <typename Key, typename Value, typename Monoid>
+AggregateNode<Key, Value, Monoid>::AggregateNode(
+    ItemMaker<Key, Value>& maker, AggregateNode<Key, Value, Monoid>* parent)
+    : AVLNode<Key, Value>(maker, parent),
+      aggregate_(Monoid::lift(this->item_.first, this->item_.second)) {}
+
+template <typename Key, typename Value, typename Monoid>
+const typename AggregateNode<Key, Value, Monoid>::Aggregate&
+AggregateNode<Key, Value, Monoid>::getAggregate() const {
+    return aggregate_;
+}
+
+template <typename Key, typename Value, typename Monoid>
+void AggregateNode<Key, Value, Monoid>::setAggregate(
+    const Aggregate& aggregate) {
+    aggregate_ = aggregate;
+}
+
+/**
+ * Redefined to return AggregateNodes, like the AVLNode getters.
+ */
+template <typename Key, typename Value, typename Monoid>
+AggregateNode<Key, Value, Monoid>*
+AggregateNode<Key, Value, Monoid>::getParent() const {
+    return static_cast<AggregateNode<Key, Value, Monoid>*>(this->parent_);
+}
+
+template <typename Key, typename Value, typename Monoid>
+AggregateNode<Key, Value, Monoid>*
+AggregateNode<Key, Value, Monoid>::getLeft() const {
+    return static_cast<AggregateNode<Key, Value, Monoid>*>(this->left_);
+}
+
+template <typename Key, typename Value, typename Monoid>
+AggregateNode<Key, Value, Monoid>*
+AggregateNode<Key, Value, Monoid>::getRight() const {
+    return static_cast<AggregateNode<Key, Value, Monoid>*>(this->right_);
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the AggregateNode class.
+  -------------------------------------------------
+*/
+
+/**
+ * An AVL tree, ordered by Compare, that keeps the Monoid aggregate of every
+ * subtree, so that the aggregate over any key range can be found in
+ * O(log n). aggregate(lo, hi) takes lo and hi in Compare's order.
+ *
+ * The aggregates are only updated by the tree's own operations. Changing a
+ * value through an iterator or operator[] bypasses them, so use insert to
+ * change values instead.
+ */
+template <typename Key, typename Value, typename Monoid,
+          typename Compare = std::less<Key> >
+class AggregateAVLTree : public AVLTree<Key, Value, Compare> {
+  public:
+    typedef typename Monoid::value_type Aggregate;
+
+    AggregateAVLTree();
+    explicit AggregateAVLTree(const Compare& comp);
+    Aggregate aggregate() const;
+    Aggregate aggregate(const Key& lo, const Key& hi) const;
+
+  protected:
+    virtual void build_fix(Node<Key, Value>* node, std::size_t leftSize,
+                           std::size_t rightSize);
+    virtual void refresh_node(AVLNode<Key, Value>* node);
+    virtual void refresh_path(AVLNode<Key, Value>* node);
+
+  private:
+    typedef AggregateNode<Key, Value, Monoid> ANode;
+    static Aggregate subtree_aggregate(ANode* node);
+    static Aggregate item_aggregate(ANode* node);
+};
+
+template <typename Key, typename Value, typename Monoid, typename Compare>
+AggregateAVLTree<Key, Value, Monoid, Compare>::AggregateAVLTree() {
+    this->template use_nodes<ANode>();
+}
+
+/**
+ * Constructs an empty tree ordered by a copy of comp.
+ */
+template <typename Key, typename Value, typename Monoid, typename Compare>
+AggregateAVLTree<Key, Value, Monoid, Compare>::AggregateAVLTree(
+    const Compare& comp)
+    : AVLTree<Key, Value, Compare>(comp) {
+    this->template use_nodes<ANode>();
+}
+
+/**
+ * Returns the aggregate over the whole tree.
+ */
+template <typename Key, typename Value, typename Monoid, typename Compare>
+typename AggregateAVLTree<Key, Value, Monoid, Compare>::Aggregate
+AggregateAVLTree<Key, Value, Monoid, Compare>::aggregate() const {
+    return subtree_aggregate(static_cast<ANode*>(this->root_));
+}
+
+/**
+ * Returns the aggregate over the items with lo <= key <= hi, combined in key
+ * order. Walks down to the highest node in the range and then along its two
+ * boundary paths, taking whole subtrees wherever they fit inside the range.
+ */
+template <typename Key, typename Value, typename Monoid, typename Compare>
+typename AggregateAVLTree<Key, Value, Monoid, Compare>::Aggregate
+AggregateAVLTree<Key, Value, Monoid, Compare>::aggregate(
+    const Key& lo, const Key& hi) const {
+    ANode* split = static_cast<ANode*>(this->root_);
+    while (split != nullptr) {
+        if (this->comp_(split->getKey(), lo)) {
+            split = split->getRight();
+        } else if (this->comp_(hi, split->getKey())) {
+            split = split->getLeft();
+        } else {
+            break;
+        }
+    }
+    if (split == nullptr) {
+        return Monoid::identity();
+    }
+
+    // Everything in the left subtree is <= hi, so only lo matters
+    Aggregate left = Monoid::identity();
+    for (ANode* node = split->getLeft(); node != nullptr;) {
+        if (this->comp_(node->getKey(), lo)) {
+            node = node->getRight();
+        } else {
+            left = Monoid::combine(
+                Monoid::combine(item_aggregate(node),
+                                subtree_aggregate(node->getRight())),
+                left);
+            node = node->getLeft();
+        }
+    }
+
+    // Everything in the right subtree is >= lo, so only hi matters
+    Aggregate right = Monoid::identity();
+    for (ANode* node = split->getRight(); node != nullptr;) {
+        if (this->comp_(hi, node->getKey())) {
+            node = node->getLeft();
+        } else {
+            right = Monoid::combine(
+                right, Monoid::combine(subtree_aggregate(node->getLeft()),
+                                       item_aggregate(node)));
+            node = node->getRight();
+        }
+    }
+
+    return Monoid::combine(Monoid::combine(left, item_aggregate(split)),
+                           right);
+}
+
+/**
+ * Children are built before their parents, so each node can be computed
+ * straight from them.
+ */
+template <typename Key, typename Value, typename Monoid, typename Compare>
+void AggregateAVLTree<Key, Value, Monoid, Compare>::build_fix(
+    Node<Key, Value>* node, std::size_t leftSize, std::size_t rightSize) {
+    AVLTree<Key, Value, Compare>::build_fix(node, leftSize, rightSize);
+    refresh_node(static_cast<ANode*>(node));
+}
+
+/**
+ * Recomputes a node's aggregate from its item and its children's aggregates.
+ */
+template <typename Key, typename Value, typename Monoid, typename Compare>
+void AggregateAVLTree<Key, Value, Monoid, Compare>::refresh_node(
+    AVLNode<Key, Value>* node) {
+    ANode* n = static_cast<ANode*>(node);
+    n->setAggregate(Monoid::combine(
+        Monoid::combine(subtree_aggregate(n->getLeft()), item_aggregate(n)),
+        subtree_aggregate(n->getRight())));
+}
+
+template <typename Key, typename Value, typename Monoid, typename Compare>
+void AggregateAVLTree<Key, Value, Monoid, Compare>::refresh_path(
+    AVLNode<Key, Value>* node) {
+    while (node != nullptr) {
+        refresh_node(node);
+        node = node->getParent();
+    }
+}
+
+// Returns the aggregate of the subtree at node, which may be NULL
+template <typename Key, typename Value, typename Monoid, typename Compare>
+typename AggregateAVLTree<Key, Value, Monoid, Compare>::Aggregate
+AggregateAVLTree<Key, Value, Monoid, Compare>::subtree_aggregate(ANode* node) {
+    return node == nullptr ? Monoid::identity() : node->getAggregate();
+}
+
+// Returns the aggregate of node's own item
+template <typename Key, typename Value, typename Monoid, typename Compare>
+typename AggregateAVLTree<Key, Value, Monoid, Compare>::Aggregate
+AggregateAVLTree<Key, Value, Monoid, Compare>::item_aggregate(ANode* node) {
+    return Monoid::lift(node->getKey(), node->getValue());
+}
+
+#endif
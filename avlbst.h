@@ -1,38 +1,55 @@
-#ifndef RBBST_H
-#define RBBST_H
+#ifndef AVLBST_H
+#define AVLBST_H
 
 #include "bst.h"
+#include "task_pool.h"
 #include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <exception>
+#include <functional>
 #include <iostream>
+#include <stdexcept>
+#include <typeinfo>
+#include <utility>
+#include <vector>
 
 struct KeyError {};
 
+/**
+ * What AVLTree::insert_batch did with the pairs it was given.
+ */
+struct BatchInsertResult {
+    std::size_t inserted;    // keys that were not in the tree before
+    std::size_t overwritten; // keys already in the tree, given new values
+};
+
 /**
  * A special kind of node for an AVL tree, which adds the balance as a data
  * member, plus other additional helper functions. You do NOT need to implement
  * any functionality or add additional data members or helper functions.
+ * Sized is its tree's, and adds the subtree size (see SizedNode).
  */
-template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value> {
+template <typename Key, typename Value, bool Sized = false>
+class AVLNode : public BaseNode<Key, Value, Sized> {
   public:
     // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    AVLNode(const Key& key, const Value& value,
+            AVLNode<Key, Value, Sized>* parent);
+    AVLNode(ItemMaker<Key, Value>& maker, AVLNode<Key, Value, Sized>* parent);
+    ~AVLNode() = default;
 
     // Getter/setter for the node's height.
     int8_t getBalance() const;
     void setBalance(int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since
+    // Getters for parent, left, and right. These hide the Node versions since
     // they return pointers to AVLNodes - not plain Nodes. See the Node class in
     // bst.h for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    AVLNode<Key, Value, Sized>* getParent() const;
+    AVLNode<Key, Value, Sized>* getLeft() const;
+    AVLNode<Key, Value, Sized>* getRight() const;
 
   protected:
     int8_t balance_; // effectively a signed char
@@ -46,66 +63,71 @@ class AVLNode : public Node<Key, Value> {
 
 /**
  * An explicit constructor to initialize the elements by calling the base class
- * constructor and setting the color to red since every new node will be red
+ * constructor and setting the balance to 0 since every new node is a leaf
  * when it is first inserted.
  */
-template <class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value,
-                             AVLNode<Key, Value>* parent)
-    : Node<Key, Value>(key, value, parent), balance_(0) {}
+template <class Key, class Value, bool Sized>
+AVLNode<Key, Value, Sized>::AVLNode(const Key& key, const Value& value,
+                                    AVLNode<Key, Value, Sized>* parent)
+    : BaseNode<Key, Value, Sized>(key, value, parent), balance_(0) {}
 
 /**
- * A destructor which does nothing.
+ * Constructs a node whose item is built in place by maker.
  */
-template <class Key, class Value> AVLNode<Key, Value>::~AVLNode() {}
+template <class Key, class Value, bool Sized>
+AVLNode<Key, Value, Sized>::AVLNode(ItemMaker<Key, Value>& maker,
+                                    AVLNode<Key, Value, Sized>* parent)
+    : BaseNode<Key, Value, Sized>(maker, parent), balance_(0) {}
 
 /**
  * A getter for the balance of a AVLNode.
  */
-template <class Key, class Value>
-int8_t AVLNode<Key, Value>::getBalance() const {
+template <class Key, class Value, bool Sized>
+int8_t AVLNode<Key, Value, Sized>::getBalance() const {
     return balance_;
 }
 
 /**
  * A setter for the balance of a AVLNode.
  */
-template <class Key, class Value>
-void AVLNode<Key, Value>::setBalance(int8_t balance) {
+template <class Key, class Value, bool Sized>
+void AVLNode<Key, Value, Sized>::setBalance(int8_t balance) {
+    BST_NOTE_WRITE(FIELD_BALANCE);
     balance_ = balance;
 }
 
 /**
  * Adds diff to the balance of a AVLNode.
  */
-template <class Key, class Value>
-void AVLNode<Key, Value>::updateBalance(int8_t diff) {
+template <class Key, class Value, bool Sized>
+void AVLNode<Key, Value, Sized>::updateBalance(int8_t diff) {
+    BST_NOTE_WRITE(FIELD_BALANCE);
     balance_ += diff;
 }
 
 /**
- * An overridden function for getting the parent since a static_cast is
- * necessary to make sure that our node is a AVLNode.
+ * A getter for the parent, with a static_cast since every node linked into an
+ * AVLTree is an AVLNode.
  */
-template <class Key, class Value>
-AVLNode<Key, Value>* AVLNode<Key, Value>::getParent() const {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+template <class Key, class Value, bool Sized>
+AVLNode<Key, Value, Sized>* AVLNode<Key, Value, Sized>::getParent() const {
+    return static_cast<AVLNode<Key, Value, Sized>*>(this->parent_);
 }
 
 /**
- * Overridden for the same reasons as above.
+ * Redefined for the same reasons as above.
  */
-template <class Key, class Value>
-AVLNode<Key, Value>* AVLNode<Key, Value>::getLeft() const {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+template <class Key, class Value, bool Sized>
+AVLNode<Key, Value, Sized>* AVLNode<Key, Value, Sized>::getLeft() const {
+    return static_cast<AVLNode<Key, Value, Sized>*>(this->left_);
 }
 
 /**
- * Overridden for the same reasons as above.
+ * Redefined for the same reasons as above.
  */
-template <class Key, class Value>
-AVLNode<Key, Value>* AVLNode<Key, Value>::getRight() const {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+template <class Key, class Value, bool Sized>
+AVLNode<Key, Value, Sized>* AVLNode<Key, Value, Sized>::getRight() const {
+    return static_cast<AVLNode<Key, Value, Sized>*>(this->right_);
 }
 
 /*
@@ -114,85 +136,311 @@ AVLNode<Key, Value>* AVLNode<Key, Value>::getRight() const {
   -----------------------------------------------
 */
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value> {
+/**
+ * A self-balancing AVL tree. Sized is as for BinarySearchTree: true adds
+ * subtree sizes to the nodes, for rank, select and an O(1) size().
+ */
+template <class Key, class Value, class Compare = std::less<Key>,
+          bool Sized = false>
+class AVLTree : public BinarySearchTree<Key, Value, Compare, Sized> {
   public:
+    AVLTree();
+    explicit AVLTree(const Compare& comp);
+    using BinarySearchTree<Key, Value, Compare, Sized>::insert;
     virtual void insert(const std::pair<const Key, Value>& new_item);
     virtual void remove(const Key& key);
+    template <typename InputIt>
+    BatchInsertResult insert_batch(InputIt first, InputIt last);
+    void join(AVLTree<Key, Value, Compare, Sized>& left,
+              const std::pair<const Key, Value>& item,
+              AVLTree<Key, Value, Compare, Sized>& right);
+    void split(const Key& key, AVLTree<Key, Value, Compare, Sized>& left,
+               AVLTree<Key, Value, Compare, Sized>& right);
+    void union_with(AVLTree<Key, Value, Compare, Sized>& other);
+    void intersection_with(AVLTree<Key, Value, Compare, Sized>& other);
+    void difference_with(AVLTree<Key, Value, Compare, Sized>& other);
+    void union_with(AVLTree<Key, Value, Compare, Sized>& other, TaskPool& pool,
+                    std::size_t grain = 16384);
+    void intersection_with(AVLTree<Key, Value, Compare, Sized>& other,
+                           TaskPool& pool, std::size_t grain = 16384);
+    void difference_with(AVLTree<Key, Value, Compare, Sized>& other,
+                         TaskPool& pool, std::size_t grain = 16384);
 
   protected:
-    virtual void nodeSwap(AVLNode<Key, Value>* n1, AVLNode<Key, Value>* n2);
+    virtual void nodeSwap(AVLNode<Key, Value, Sized>* n1,
+                          AVLNode<Key, Value, Sized>* n2);
+    virtual Node<Key, Value>* insert_item(ItemMaker<Key, Value>& maker,
+                                          Node<Key, Value>* hint,
+                                          bool& inserted);
+    virtual void build_fix(Node<Key, Value>* node, std::size_t leftSize,
+                           std::size_t rightSize);
+    // Hooks for trees that keep extra data in their nodes. refresh_node is
+    // called whenever a node's children change, and refresh_path when
+    // something changed below or at node and everything from there up to the
+    // root needs recomputing.
+    virtual void refresh_node(AVLNode<Key, Value, Sized>* node);
+    virtual void refresh_path(AVLNode<Key, Value, Sized>* node);
 
     // Add helper functions here
   private:
-    void insert_helper(const std::pair<const Key, Value>& new_item,
-                       AVLNode<Key, Value>* node);
-    void insert_fix(AVLNode<Key, Value>* p, AVLNode<Key, Value>* n);
-    void rotate_right(AVLNode<Key, Value>* y);
-    void rotate_left(AVLNode<Key, Value>* x);
-    void remove_fix(AVLNode<Key, Value>* n, int diff);
+    AVLNode<Key, Value, Sized>* insert_helper(ItemMaker<Key, Value>& maker,
+                                              AVLNode<Key, Value, Sized>* node,
+                                              bool& inserted);
+    void insert_fix(AVLNode<Key, Value, Sized>* p,
+                    AVLNode<Key, Value, Sized>* n);
+    AVLNode<Key, Value, Sized>* rotate_right(AVLNode<Key, Value, Sized>* y);
+    AVLNode<Key, Value, Sized>* rotate_left(AVLNode<Key, Value, Sized>* x);
+    void remove_fix(AVLNode<Key, Value, Sized>* n, int diff);
+    AVLNode<Key, Value, Sized>* detach_root();
+
+    // Where the set operations may fork subproblems, and the number of nodes
+    // below which they run serially. A NULL Fork means never.
+    struct Fork {
+        TaskPool* pool;
+        std::size_t grain;
+    };
+
+    // Helpers for join, split and the set operations. They work on detached
+    // subtrees (whose roots have no parent) and pass their heights around,
+    // since AVL nodes only store balances.
+    static int height_of(AVLNode<Key, Value, Sized>* node);
+    static std::size_t min_size(int height);
+    static void child_heights(AVLNode<Key, Value, Sized>* node, int height,
+                              int& leftHeight, int& rightHeight);
+    static AVLNode<Key, Value, Sized>* detach(AVLNode<Key, Value, Sized>* node);
+    void check_compatible(
+        const AVLTree<Key, Value, Compare, Sized>& other) const;
+    void adopt_allocator(const AVLTree<Key, Value, Compare, Sized>& other);
+    AVLNode<Key, Value, Sized>* link_nodes(AVLNode<Key, Value, Sized>* l,
+                                           int hl,
+                                           AVLNode<Key, Value, Sized>* k,
+                                           AVLNode<Key, Value, Sized>* r,
+                                           int hr, int& h);
+    AVLNode<Key, Value, Sized>* join_nodes(AVLNode<Key, Value, Sized>* l,
+                                           int hl,
+                                           AVLNode<Key, Value, Sized>* k,
+                                           AVLNode<Key, Value, Sized>* r,
+                                           int hr, int& h);
+    AVLNode<Key, Value, Sized>* join_right(AVLNode<Key, Value, Sized>* l,
+                                           int hl,
+                                           AVLNode<Key, Value, Sized>* k,
+                                           AVLNode<Key, Value, Sized>* r,
+                                           int hr, int& h);
+    AVLNode<Key, Value, Sized>* join_left(AVLNode<Key, Value, Sized>* l, int hl,
+                                          AVLNode<Key, Value, Sized>* k,
+                                          AVLNode<Key, Value, Sized>* r, int hr,
+                                          int& h);
+    AVLNode<Key, Value, Sized>* join2_nodes(AVLNode<Key, Value, Sized>* l,
+                                            int hl,
+                                            AVLNode<Key, Value, Sized>* r,
+                                            int hr, int& h);
+    AVLNode<Key, Value, Sized>* split_last(AVLNode<Key, Value, Sized>* t,
+                                           int ht,
+                                           AVLNode<Key, Value, Sized>*& rest,
+                                           int& hrest);
+    void split_nodes(AVLNode<Key, Value, Sized>* t, int ht, const Key& key,
+                     AVLNode<Key, Value, Sized>*& l, int& hl,
+                     AVLNode<Key, Value, Sized>*& mid,
+                     AVLNode<Key, Value, Sized>*& r, int& hr);
+    void unite(AVLTree<Key, Value, Compare, Sized>& other, const Fork* fork);
+    void intersect(AVLTree<Key, Value, Compare, Sized>& other,
+                   const Fork* fork);
+    void subtract(AVLTree<Key, Value, Compare, Sized>& other, const Fork* fork);
+    const Fork* fork_for(const AVLTree<Key, Value, Compare, Sized>& other,
+                         Fork& fork, TaskPool& pool, std::size_t grain) const;
+    template <typename F1, typename F2>
+    static void fork_join(const Fork* fork, std::size_t work, F1 a, F2 b);
+    AVLNode<Key, Value, Sized>* union_nodes(AVLNode<Key, Value, Sized>* a,
+                                            int ha,
+                                            AVLNode<Key, Value, Sized>* b,
+                                            int hb, int& h, const Fork* fork);
+    AVLNode<Key, Value, Sized>* intersection_nodes(
+        AVLNode<Key, Value, Sized>* a, int ha, AVLNode<Key, Value, Sized>* b,
+        int hb, AVLTree<Key, Value, Compare, Sized>& other, int& h,
+        const Fork* fork);
+    AVLNode<Key, Value, Sized>* difference_nodes(
+        AVLNode<Key, Value, Sized>* a, int ha, AVLNode<Key, Value, Sized>* b,
+        int hb, AVLTree<Key, Value, Compare, Sized>& other, int& h,
+        const Fork* fork);
 };
 
+template <class Key, class Value, class Compare, bool Sized>
+AVLTree<Key, Value, Compare, Sized>::AVLTree() {
+    this->template use_nodes<AVLNode<Key, Value, Sized> >();
+}
+
+/**
+ * Constructs an empty tree ordered by a copy of comp.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+AVLTree<Key, Value, Compare, Sized>::AVLTree(const Compare& comp)
+    : BinarySearchTree<Key, Value, Compare, Sized>(comp) {
+    this->template use_nodes<AVLNode<Key, Value, Sized> >();
+}
+
 /*
  * Recall: If key is already in the tree, you should
  * overwrite the current value with the updated value.
  */
-template <class Key, class Value>
-void AVLTree<Key, Value>::insert(const std::pair<const Key, Value>& new_item) {
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::insert(
+    const std::pair<const Key, Value>& new_item) {
+    CopiedItem<Key, Value> maker(new_item.first, new_item.second);
+    bool inserted;
+    insert_item(maker, nullptr, inserted);
+}
+
+/**
+ * Every insertion, including the emplace family, goes through here.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+Node<Key, Value>*
+AVLTree<Key, Value, Compare, Sized>::insert_item(ItemMaker<Key, Value>& maker,
+                                                 Node<Key, Value>* hint,
+                                                 bool& inserted) {
     if (this->root_ == nullptr) {
         // Tree is empty
-        this->root_ =
-            new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
+        this->root_ = this->create_node(maker, nullptr);
+        inserted = true;
+        this->finger_ = this->root_;
+        return this->root_;
+    }
+    AVLNode<Key, Value, Sized>* start =
+        static_cast<AVLNode<Key, Value, Sized>*>(
+            this->insert_start(maker.key(), hint));
+    this->finger_ = insert_helper(maker, start, inserted);
+    return this->finger_;
+}
+
+// Iterative helper function for insert. Inserts maker's item into the subtree
+// at node, which must be able to hold its key, and returns the node that
+// holds it afterwards. inserted is set to false if the key was already there.
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>* AVLTree<Key, Value, Compare, Sized>::insert_helper(
+    ItemMaker<Key, Value>& maker, AVLNode<Key, Value, Sized>* node,
+    bool& inserted) {
+    Node<Key, Value>* parent;
+    bool left;
+    Node<Key, Value>* found = this->find_slot(maker.key(), node, parent, left);
+    if (found != nullptr) {
+        maker.found(found->getValue());
+        refresh_path(static_cast<AVLNode<Key, Value, Sized>*>(found));
+        inserted = false;
+        return static_cast<AVLNode<Key, Value, Sized>*>(found);
+    }
+
+    node = static_cast<AVLNode<Key, Value, Sized>*>(parent);
+    AVLNode<Key, Value, Sized>* n = static_cast<AVLNode<Key, Value, Sized>*>(
+        this->create_node(maker, node));
+    if (left) {
+        node->setLeft(n);
     } else {
-        insert_helper(new_item, (AVLNode<Key, Value>*)this->root_);
+        node->setRight(n);
     }
+    this->update_sizes(node, 1, 0);
+    refresh_path(node);
+    if (node->getBalance() != 0) {
+        node->setBalance(0);
+    } else {
+        node->setBalance(left ? -1 : 1);
+        insert_fix(node, n);
+    }
+    inserted = true;
+    return n;
 }
 
-// Recursive helper function for insert
-template <class Key, class Value>
-void AVLTree<Key, Value>::insert_helper(
-    const std::pair<const Key, Value>& new_item, AVLNode<Key, Value>* node) {
-    if (new_item.first < node->getKey()) {
-        if (node->getLeft() == nullptr) {
-            AVLNode<Key, Value>* n =
-                new AVLNode<Key, Value>(new_item.first, new_item.second, node);
-            node->setLeft(n);
-            if (node->getBalance() != 0) {
-                node->setBalance(0);
+/**
+ * Inserts every pair in [first, last), in any order, with the same result as
+ * inserting them one at a time (later pairs win over earlier ones with the
+ * same key).
+ *
+ * The batch is sorted first. A batch that is large compared to the tree is
+ * merged with the tree's contents and the tree is rebuilt in linear time.
+ * Otherwise the keys are inserted in order, each starting from the node where
+ * the previous one ended up instead of from the root.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+template <typename InputIt>
+BatchInsertResult
+AVLTree<Key, Value, Compare, Sized>::insert_batch(InputIt first, InputIt last) {
+    typedef std::pair<Key, Value> Item;
+    std::vector<Item> batch(first, last);
+    BatchInsertResult result;
+    result.inserted = 0;
+
+    // Sort, then keep only the last pair for each key
+    std::stable_sort(batch.begin(), batch.end(),
+                     [this](const Item& a, const Item& b) {
+                         return this->comp_(a.first, b.first);
+                     });
+    std::size_t unique = 0;
+    for (std::size_t i = 0; i < batch.size(); i++) {
+        if (unique > 0 &&
+            !this->comp_(batch[unique - 1].first, batch[i].first)) {
+            batch[unique - 1].second = batch[i].second;
+        } else {
+            if (unique != i) {
+                batch[unique] = batch[i];
+            }
+            unique++;
+        }
+    }
+    batch.resize(unique);
+
+    // Rebuilding costs O(n), so only do it for batches with at least one key
+    // for every eight in the tree. Without subtree sizes, the tree is only
+    // counted as far as that takes.
+    std::size_t limit = 8 * unique + 8;
+    std::size_t size = Sized ? this->size() : this->count_nodes(limit);
+    if (size < limit) {
+        // Merge with the existing contents and rebuild
+        std::vector<Item> merged;
+        merged.reserve(unique + size);
+        std::size_t i = 0;
+        for (typename AVLTree<Key, Value, Compare, Sized>::iterator it =
+                 this->begin();
+             it != this->end(); ++it) {
+            while (i < unique && this->comp_(batch[i].first, it->first)) {
+                merged.push_back(batch[i++]);
+                result.inserted++;
+            }
+            if (i < unique && !this->comp_(it->first, batch[i].first)) {
+                merged.push_back(batch[i++]);
             } else {
-                node->setBalance(-1);
-                insert_fix(node, n);
+                merged.push_back(Item(it->first, it->second));
             }
-        } else {
-            insert_helper(new_item, node->getLeft());
         }
-    } else if (new_item.first == node->getKey()) {
-        node->setValue(new_item.second);
+        for (; i < unique; i++) {
+            merged.push_back(batch[i]);
+            result.inserted++;
+        }
+        this->build_from_sorted(merged.begin(), merged.end());
     } else {
-        // new_item.first > node->getKey()
-        if (node->getRight() == nullptr) {
-            AVLNode<Key, Value>* n =
-                new AVLNode<Key, Value>(new_item.first, new_item.second, node);
-            node->setRight(n);
-            if (node->getBalance() != 0) {
-                node->setBalance(0);
-            } else {
-                node->setBalance(1);
-                insert_fix(node, n);
+        // Finger insertion: start each search from the previous key's node,
+        // climbing only until the key is within the current subtree.
+        for (std::size_t i = 0; i < unique; i++) {
+            // The batch is a private copy, so its items can be moved in
+            ForwardedItem<Key, Value, Item> item(std::move(batch[i]));
+            bool inserted;
+            insert_item(item, this->finger_, inserted);
+            if (inserted) {
+                result.inserted++;
             }
-        } else {
-            insert_helper(new_item, node->getRight());
         }
     }
+    // Repeats of a key within the batch don't count as overwrites
+    result.overwritten = unique - result.inserted;
+    return result;
 }
 
-template <class Key, class Value>
-void AVLTree<Key, Value>::insert_fix(AVLNode<Key, Value>* p,
-                                     AVLNode<Key, Value>* n) {
+template <class Key, class Value, class Compare, bool Sized>
+void
+AVLTree<Key, Value, Compare, Sized>::insert_fix(AVLNode<Key, Value, Sized>* p,
+                                                AVLNode<Key, Value, Sized>* n) {
     if (p == nullptr || p->getParent() == nullptr) {
         return;
     }
-    AVLNode<Key, Value>* g = p->getParent();
+    AVLNode<Key, Value, Sized>* g = p->getParent();
     if (p == g->getLeft()) {
         // p is left child
         g->setBalance(g->getBalance() - 1);
@@ -268,13 +516,19 @@ void AVLTree<Key, Value>::insert_fix(AVLNode<Key, Value>* p,
     }
 }
 
-template <class Key, class Value>
-void AVLTree<Key, Value>::rotate_right(AVLNode<Key, Value>* y) {
-    AVLNode<Key, Value>* x = y->getLeft();
-    AVLNode<Key, Value>* b = x->getRight();
-    AVLNode<Key, Value>* p = y->getParent();
+// Returns the node that takes y's place. Detached subtrees (used by join and
+// split) can be rotated too, as long as y isn't the tree's root.
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>* AVLTree<Key, Value, Compare, Sized>::rotate_right(
+    AVLNode<Key, Value, Sized>* y) {
+    BST_NOTE_ROTATION();
+    AVLNode<Key, Value, Sized>* x = y->getLeft();
+    AVLNode<Key, Value, Sized>* b = x->getRight();
+    AVLNode<Key, Value, Sized>* p = y->getParent();
     if (p == nullptr) {
-        this->root_ = x;
+        if (this->root_ == y) {
+            this->root_ = x;
+        }
     } else {
         if (p->getLeft() == y) {
             p->setLeft(x);
@@ -289,15 +543,26 @@ void AVLTree<Key, Value>::rotate_right(AVLNode<Key, Value>* y) {
     if (b != nullptr) {
         b->setParent(y);
     }
+    this->recount(y);
+    this->recount(x);
+    refresh_node(y);
+    refresh_node(x);
+    return x;
 }
 
-template <class Key, class Value>
-void AVLTree<Key, Value>::rotate_left(AVLNode<Key, Value>* x) {
-    AVLNode<Key, Value>* y = x->getRight();
-    AVLNode<Key, Value>* b = y->getLeft();
-    AVLNode<Key, Value>* p = x->getParent();
+// Returns the node that takes x's place. Detached subtrees (used by join and
+// split) can be rotated too, as long as x isn't the tree's root.
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>* AVLTree<Key, Value, Compare, Sized>::rotate_left(
+    AVLNode<Key, Value, Sized>* x) {
+    BST_NOTE_ROTATION();
+    AVLNode<Key, Value, Sized>* y = x->getRight();
+    AVLNode<Key, Value, Sized>* b = y->getLeft();
+    AVLNode<Key, Value, Sized>* p = x->getParent();
     if (p == nullptr) {
-        this->root_ = y;
+        if (this->root_ == x) {
+            this->root_ = y;
+        }
     } else {
         if (p->getLeft() == x) {
             p->setLeft(y);
@@ -312,23 +577,29 @@ void AVLTree<Key, Value>::rotate_left(AVLNode<Key, Value>* x) {
     if (b != nullptr) {
         b->setParent(x);
     }
+    this->recount(x);
+    this->recount(y);
+    refresh_node(x);
+    refresh_node(y);
+    return y;
 }
 
 /*
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template <class Key, class Value>
-void AVLTree<Key, Value>::remove(const Key& key) {
-    AVLNode<Key, Value>* n = (AVLNode<Key, Value>*)this->internalFind(key);
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::remove(const Key& key) {
+    AVLNode<Key, Value, Sized>* n =
+        (AVLNode<Key, Value, Sized>*)this->internalFind(key);
     if (n == nullptr) {
         return;
     }
     if (n->getLeft() != nullptr && n->getRight() != nullptr) {
         // n has two children
-        nodeSwap(n, (AVLNode<Key, Value>*)this->predecessor(n));
+        nodeSwap(n, (AVLNode<Key, Value, Sized>*)this->predecessor(n));
     }
-    AVLNode<Key, Value>* p = n->getParent();
+    AVLNode<Key, Value, Sized>* p = n->getParent();
     int diff = 0;
     if (p != nullptr) {
         if (n == p->getLeft()) {
@@ -339,12 +610,15 @@ void AVLTree<Key, Value>::remove(const Key& key) {
             diff = -1;
         }
     }
-    AVLNode<Key, Value>* c = n->getLeft();
+    AVLNode<Key, Value, Sized>* c = n->getLeft();
     if (c == nullptr) {
         c = n->getRight();
     }
 
-    delete n;
+    if (n == this->finger_) {
+        this->finger_ = nullptr;
+    }
+    this->destroy_node(n);
     // Fix pointers
     if (p == nullptr) {
         // n was root node
@@ -362,15 +636,19 @@ void AVLTree<Key, Value>::remove(const Key& key) {
     if (c != nullptr) {
         c->setParent(p);
     }
+    this->update_sizes(p, 0, 1);
+    refresh_path(p);
     remove_fix(p, diff);
 }
 
-template <class Key, class Value>
-void AVLTree<Key, Value>::remove_fix(AVLNode<Key, Value>* n, int diff) {
+template <class Key, class Value, class Compare, bool Sized>
+void
+AVLTree<Key, Value, Compare, Sized>::remove_fix(AVLNode<Key, Value, Sized>* n,
+                                                int diff) {
     if (n == nullptr) {
         return;
     }
-    AVLNode<Key, Value>* p = n->getParent();
+    AVLNode<Key, Value, Sized>* p = n->getParent();
     int ndiff = 0;
     if (p != nullptr) {
         if (n == p->getLeft()) {
@@ -383,7 +661,7 @@ void AVLTree<Key, Value>::remove_fix(AVLNode<Key, Value>* n, int diff) {
     }
     switch (n->getBalance() + diff) {
     case -2: {
-        AVLNode<Key, Value>* c = n->getLeft();
+        AVLNode<Key, Value, Sized>* c = n->getLeft();
         switch (c->getBalance()) {
         case -1: // zig-zig case
             rotate_right(n);
@@ -397,7 +675,7 @@ void AVLTree<Key, Value>::remove_fix(AVLNode<Key, Value>* n, int diff) {
             c->setBalance(1);
             break;
         case 1: { // zig-zag case
-            AVLNode<Key, Value>* g = c->getRight();
+            AVLNode<Key, Value, Sized>* g = c->getRight();
             rotate_left(c);
             rotate_right(n);
             switch (g->getBalance()) {
@@ -422,7 +700,7 @@ void AVLTree<Key, Value>::remove_fix(AVLNode<Key, Value>* n, int diff) {
         break;
     }
     case 2: {
-        AVLNode<Key, Value>* c = n->getRight();
+        AVLNode<Key, Value, Sized>* c = n->getRight();
         switch (c->getBalance()) {
         case 1: // zig-zig case
             rotate_left(n);
@@ -436,7 +714,7 @@ void AVLTree<Key, Value>::remove_fix(AVLNode<Key, Value>* n, int diff) {
             c->setBalance(-1);
             break;
         case -1: { // zig-zag case
-            AVLNode<Key, Value>* g = c->getLeft();
+            AVLNode<Key, Value, Sized>* g = c->getLeft();
             rotate_right(c);
             rotate_left(n);
             switch (g->getBalance()) {
@@ -473,13 +751,709 @@ void AVLTree<Key, Value>::remove_fix(AVLNode<Key, Value>* n, int diff) {
     }
 }
 
-template <class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap(AVLNode<Key, Value>* n1,
-                                   AVLNode<Key, Value>* n2) {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+template <class Key, class Value, class Compare, bool Sized>
+void
+AVLTree<Key, Value, Compare, Sized>::nodeSwap(AVLNode<Key, Value, Sized>* n1,
+                                              AVLNode<Key, Value, Sized>* n2) {
+    BinarySearchTree<Key, Value, Compare, Sized>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
 }
 
+/**
+ * Nodes built by build_from_sorted get their balance straight from the
+ * subtree heights, which follow from their sizes.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::build_fix(Node<Key, Value>* node,
+                                                    std::size_t leftSize,
+                                                    std::size_t rightSize) {
+    static_cast<AVLNode<Key, Value, Sized>*>(node)->setBalance(
+        static_cast<int8_t>(this->min_height(rightSize) -
+                            this->min_height(leftSize)));
+}
+
+/**
+ * Plain AVL trees have nothing extra to refresh.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::refresh_node(
+    AVLNode<Key, Value, Sized>* node) {}
+
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::refresh_path(
+    AVLNode<Key, Value, Sized>* node) {}
+
+/*
+  -----------------------------------------------------
+  Begin implementations for join, split and set operations.
+  -----------------------------------------------------
+*/
+
+/**
+ * Makes this tree hold the items of left, then item, then those of right,
+ * leaving left and right empty. Every key in left must be less than
+ * item.first, which must be less than every key in right. Takes O(log n).
+ */
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::join(
+    AVLTree<Key, Value, Compare, Sized>& left,
+    const std::pair<const Key, Value>& item,
+    AVLTree<Key, Value, Compare, Sized>& right) {
+    check_compatible(left);
+    check_compatible(right);
+    if (&left == &right && left.root_ != nullptr) {
+        throw std::invalid_argument("Can't join a tree with itself");
+    }
+    Node<Key, Value>* leftMax = left.root_;
+    while (leftMax != nullptr && leftMax->getRight() != nullptr) {
+        leftMax = leftMax->getRight();
+    }
+    if ((leftMax != nullptr && !this->comp_(leftMax->getKey(), item.first)) ||
+        (right.root_ != nullptr &&
+         !this->comp_(item.first, right.getSmallestNode()->getKey()))) {
+        throw std::invalid_argument("Keys out of order for join");
+    }
+    if (left.root_ != nullptr && right.root_ != nullptr &&
+        left.alloc_ != right.alloc_) {
+        throw std::invalid_argument("Joined trees must share an allocator");
+    }
+
+    AVLNode<Key, Value, Sized>* l = detach(left.detach_root());
+    AVLNode<Key, Value, Sized>* r = detach(right.detach_root());
+    this->clear();
+    if (l != nullptr) {
+        adopt_allocator(left);
+    } else if (r != nullptr) {
+        adopt_allocator(right);
+    }
+    CopiedItem<Key, Value> maker(item.first, item.second);
+    AVLNode<Key, Value, Sized>* k = static_cast<AVLNode<Key, Value, Sized>*>(
+        this->create_node(maker, nullptr));
+    int h;
+    this->root_ = join_nodes(l, height_of(l), k, r, height_of(r), h);
+}
+
+/**
+ * Moves the items with keys less than key into left and the rest into right,
+ * replacing whatever they held, and leaves this tree empty. Takes O(log n).
+ */
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::split(
+    const Key& key, AVLTree<Key, Value, Compare, Sized>& left,
+    AVLTree<Key, Value, Compare, Sized>& right) {
+    check_compatible(left);
+    check_compatible(right);
+    if (&left == &right) {
+        throw std::invalid_argument("Split needs two different trees");
+    }
+    AVLNode<Key, Value, Sized>* t = detach(this->detach_root());
+    int ht = height_of(t);
+    left.clear();
+    right.clear();
+    left.adopt_allocator(*this);
+    right.adopt_allocator(*this);
+
+    AVLNode<Key, Value, Sized>* l;
+    AVLNode<Key, Value, Sized>* mid;
+    AVLNode<Key, Value, Sized>* r;
+    int hl, hr;
+    split_nodes(t, ht, key, l, hl, mid, r, hr);
+    if (mid != nullptr) {
+        r = join_nodes(nullptr, 0, mid, r, hr, hr);
+    }
+    left.root_ = l;
+    right.root_ = r;
+}
+
+/**
+ * Adds every item of other to this tree, leaving other empty. Where both
+ * trees have a key, other's value wins, as if its items had been inserted.
+ * Takes O(m log(n/m + 1)) for trees of sizes m <= n.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::union_with(
+    AVLTree<Key, Value, Compare, Sized>& other) {
+    unite(other, nullptr);
+}
+
+/**
+ * Removes the items whose keys are not in other, keeping this tree's values,
+ * and leaves other empty.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::intersection_with(
+    AVLTree<Key, Value, Compare, Sized>& other) {
+    intersect(other, nullptr);
+}
+
+/**
+ * Removes the items whose keys are in other, and leaves other empty.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::difference_with(
+    AVLTree<Key, Value, Compare, Sized>& other) {
+    subtract(other, nullptr);
+}
+
+/**
+ * Parallel versions of the set operations. The two halves of every split are
+ * worked on as separate tasks on pool, down to subproblems of fewer than
+ * grain nodes, which are done serially. The result is the same as the serial
+ * version's.
+ *
+ * Nodes are freed from several threads at once, so if either tree's
+ * allocator isn't thread-safe the operation runs serially instead.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::union_with(
+    AVLTree<Key, Value, Compare, Sized>& other, TaskPool& pool,
+    std::size_t grain) {
+    Fork fork;
+    const Fork* f = fork_for(other, fork, pool, grain);
+    pool.run([&] { unite(other, f); });
+}
+
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::intersection_with(
+    AVLTree<Key, Value, Compare, Sized>& other, TaskPool& pool,
+    std::size_t grain) {
+    Fork fork;
+    const Fork* f = fork_for(other, fork, pool, grain);
+    pool.run([&] { intersect(other, f); });
+}
+
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::difference_with(
+    AVLTree<Key, Value, Compare, Sized>& other, TaskPool& pool,
+    std::size_t grain) {
+    Fork fork;
+    const Fork* f = fork_for(other, fork, pool, grain);
+    pool.run([&] { subtract(other, f); });
+}
+
+// Shared body of both versions of union_with
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::unite(
+    AVLTree<Key, Value, Compare, Sized>& other, const Fork* fork) {
+    if (&other == this || other.root_ == nullptr) {
+        return;
+    }
+    check_compatible(other);
+    if (this->root_ == nullptr) {
+        adopt_allocator(other);
+    } else if (this->alloc_ != other.alloc_) {
+        throw std::invalid_argument("United trees must share an allocator");
+    }
+    AVLNode<Key, Value, Sized>* a = detach(this->detach_root());
+    AVLNode<Key, Value, Sized>* b = detach(other.detach_root());
+    int h;
+    this->root_ = union_nodes(a, height_of(a), b, height_of(b), h, fork);
+}
+
+// Shared body of both versions of intersection_with
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::intersect(
+    AVLTree<Key, Value, Compare, Sized>& other, const Fork* fork) {
+    if (&other == this) {
+        return;
+    }
+    check_compatible(other);
+    AVLNode<Key, Value, Sized>* a = detach(this->detach_root());
+    AVLNode<Key, Value, Sized>* b = detach(other.detach_root());
+    int h;
+    this->root_ =
+        intersection_nodes(a, height_of(a), b, height_of(b), other, h, fork);
+}
+
+// Shared body of both versions of difference_with
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::subtract(
+    AVLTree<Key, Value, Compare, Sized>& other, const Fork* fork) {
+    if (&other == this) {
+        this->clear();
+        return;
+    }
+    check_compatible(other);
+    AVLNode<Key, Value, Sized>* a = detach(this->detach_root());
+    AVLNode<Key, Value, Sized>* b = detach(other.detach_root());
+    int h;
+    this->root_ =
+        difference_nodes(a, height_of(a), b, height_of(b), other, h, fork);
+}
+
+// Fills in fork for a parallel set operation with other, or returns NULL if
+// it has to run serially
+template <class Key, class Value, class Compare, bool Sized>
+const typename AVLTree<Key, Value, Compare, Sized>::Fork*
+AVLTree<Key, Value, Compare, Sized>::fork_for(
+    const AVLTree<Key, Value, Compare, Sized>& other, Fork& fork,
+    TaskPool& pool, std::size_t grain) const {
+    if (!this->alloc_->thread_safe() || !other.alloc_->thread_safe()) {
+        return nullptr;
+    }
+    fork.pool = &pool;
+    fork.grain = grain;
+    return &fork;
+}
+
+// Runs a and b, in parallel if fork allows it and work (at least the number
+// of nodes they cover, going by min_size) is big enough
+template <class Key, class Value, class Compare, bool Sized>
+template <typename F1, typename F2>
+void
+AVLTree<Key, Value, Compare, Sized>::fork_join(const Fork* fork,
+                                               std::size_t work, F1 a, F2 b) {
+    if (fork != nullptr && work >= fork->grain) {
+        fork->pool->fork_join(a, b);
+    } else {
+        a();
+        b();
+    }
+}
+
+// Returns the height of a subtree, found in O(log n) by always following the
+// taller child
+template <class Key, class Value, class Compare, bool Sized>
+int AVLTree<Key, Value, Compare, Sized>::height_of(
+    AVLNode<Key, Value, Sized>* node) {
+    int h = 0;
+    while (node != nullptr) {
+        h++;
+        node = node->getBalance() < 0 ? node->getLeft() : node->getRight();
+    }
+    return h;
+}
+
+// Returns the fewest nodes an AVL tree of the given height can have, which
+// the set operations go by rather than subtree sizes, since the tree may not
+// keep those. It grows by a factor of about 1.6 per level.
+template <class Key, class Value, class Compare, bool Sized>
+std::size_t AVLTree<Key, Value, Compare, Sized>::min_size(int height) {
+    std::size_t below = 0; // for height - 2
+    std::size_t size = 0;
+    for (int h = 1; h <= height; h++) {
+        std::size_t next = size + below + 1;
+        below = size;
+        size = next;
+    }
+    return size;
+}
+
+// Works out the heights of a node's subtrees from its own height and balance
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::child_heights(
+    AVLNode<Key, Value, Sized>* node, int height, int& leftHeight,
+    int& rightHeight) {
+    leftHeight = height - (node->getBalance() > 0 ? 2 : 1);
+    rightHeight = height - (node->getBalance() < 0 ? 2 : 1);
+}
+
+// Cuts node (which may be NULL) off from its parent and returns it
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>*
+AVLTree<Key, Value, Compare, Sized>::detach(AVLNode<Key, Value, Sized>* node) {
+    if (node != nullptr) {
+        node->setParent(nullptr);
+    }
+    return node;
+}
+
+// Takes the tree's nodes away from it, leaving it empty
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>* AVLTree<Key, Value, Compare, Sized>::detach_root() {
+    AVLNode<Key, Value, Sized>* root =
+        static_cast<AVLNode<Key, Value, Sized>*>(this->root_);
+    this->root_ = nullptr;
+    this->finger_ = nullptr;
+    return root;
+}
+
+// Trees can only exchange nodes if they make the same kind of node
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::check_compatible(
+    const AVLTree<Key, Value, Compare, Sized>& other) const {
+    if (typeid(*this) != typeid(other)) {
+        throw std::invalid_argument("Trees of different kinds");
+    }
+}
+
+// Switches an empty tree to the allocator of the tree it's getting nodes from
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::adopt_allocator(
+    const AVLTree<Key, Value, Compare, Sized>& other) {
+    this->alloc_ = other.alloc_;
+}
+
+// Makes l and r (whose heights differ by at most 1) the children of k, and
+// returns k as the root of a detached subtree of height h
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>*
+AVLTree<Key, Value, Compare, Sized>::link_nodes(AVLNode<Key, Value, Sized>* l,
+                                                int hl,
+                                                AVLNode<Key, Value, Sized>* k,
+                                                AVLNode<Key, Value, Sized>* r,
+                                                int hr, int& h) {
+    k->setParent(nullptr);
+    k->setLeft(l);
+    k->setRight(r);
+    if (l != nullptr) {
+        l->setParent(k);
+    }
+    if (r != nullptr) {
+        r->setParent(k);
+    }
+    k->setBalance(static_cast<int8_t>(hr - hl));
+    this->recount(k);
+    refresh_node(k);
+    h = std::max(hl, hr) + 1;
+    return k;
+}
+
+// Joins the detached subtrees l and r with k in between, returning the root
+// of the result and its height h
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>*
+AVLTree<Key, Value, Compare, Sized>::join_nodes(AVLNode<Key, Value, Sized>* l,
+                                                int hl,
+                                                AVLNode<Key, Value, Sized>* k,
+                                                AVLNode<Key, Value, Sized>* r,
+                                                int hr, int& h) {
+    AVLNode<Key, Value, Sized>* root;
+    if (hl > hr + 1) {
+        root = join_right(l, hl, k, r, hr, h);
+    } else if (hr > hl + 1) {
+        root = join_left(l, hl, k, r, hr, h);
+    } else {
+        root = link_nodes(l, hl, k, r, hr, h);
+    }
+    root->setParent(nullptr);
+    return root;
+}
+
+// Recursive helper function for join_nodes when l is taller. Walks down the
+// right spine of l to a subtree about as tall as r, joins there, and fixes
+// the balance on the way back up.
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>*
+AVLTree<Key, Value, Compare, Sized>::join_right(AVLNode<Key, Value, Sized>* l,
+                                                int hl,
+                                                AVLNode<Key, Value, Sized>* k,
+                                                AVLNode<Key, Value, Sized>* r,
+                                                int hr, int& h) {
+    if (hl <= hr + 1) {
+        return link_nodes(l, hl, k, r, hr, h);
+    }
+    int hll, hlr, ht;
+    child_heights(l, hl, hll, hlr);
+    AVLNode<Key, Value, Sized>* t =
+        join_right(l->getRight(), hlr, k, r, hr, ht);
+    l->setRight(t);
+    t->setParent(l);
+    this->recount(l);
+    if (ht <= hll + 1) {
+        l->setBalance(static_cast<int8_t>(ht - hll));
+        refresh_node(l);
+        h = std::max(hll, ht) + 1;
+        return l;
+    }
+    // t is two levels taller than l's left subtree
+    if (t->getBalance() >= 0) {
+        // zig-zig
+        int htl = ht - 1 - t->getBalance();
+        int htr = ht - 1;
+        rotate_left(l);
+        int hNewL = std::max(hll, htl) + 1;
+        l->setBalance(static_cast<int8_t>(htl - hll));
+        t->setBalance(static_cast<int8_t>(htr - hNewL));
+        h = std::max(hNewL, htr) + 1;
+        return t;
+    } else {
+        // zig-zag
+        AVLNode<Key, Value, Sized>* m = t->getLeft();
+        int hml, hmr;
+        child_heights(m, ht - 1, hml, hmr);
+        int htr = ht - 2;
+        rotate_right(t);
+        rotate_left(l);
+        l->setBalance(static_cast<int8_t>(hml - hll));
+        t->setBalance(static_cast<int8_t>(htr - hmr));
+        int hNewL = std::max(hll, hml) + 1;
+        int hNewT = std::max(hmr, htr) + 1;
+        m->setBalance(static_cast<int8_t>(hNewT - hNewL));
+        h = std::max(hNewL, hNewT) + 1;
+        return m;
+    }
+}
+
+// Mirror image of join_right, for when r is taller
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>*
+AVLTree<Key, Value, Compare, Sized>::join_left(AVLNode<Key, Value, Sized>* l,
+                                               int hl,
+                                               AVLNode<Key, Value, Sized>* k,
+                                               AVLNode<Key, Value, Sized>* r,
+                                               int hr, int& h) {
+    if (hr <= hl + 1) {
+        return link_nodes(l, hl, k, r, hr, h);
+    }
+    int hrl, hrr, ht;
+    child_heights(r, hr, hrl, hrr);
+    AVLNode<Key, Value, Sized>* t = join_left(l, hl, k, r->getLeft(), hrl, ht);
+    r->setLeft(t);
+    t->setParent(r);
+    this->recount(r);
+    if (ht <= hrr + 1) {
+        r->setBalance(static_cast<int8_t>(hrr - ht));
+        refresh_node(r);
+        h = std::max(hrr, ht) + 1;
+        return r;
+    }
+    // t is two levels taller than r's right subtree
+    if (t->getBalance() <= 0) {
+        // zig-zig
+        int htr = ht - 1 + t->getBalance();
+        int htl = ht - 1;
+        rotate_right(r);
+        int hNewR = std::max(hrr, htr) + 1;
+        r->setBalance(static_cast<int8_t>(hrr - htr));
+        t->setBalance(static_cast<int8_t>(hNewR - htl));
+        h = std::max(hNewR, htl) + 1;
+        return t;
+    } else {
+        // zig-zag
+        AVLNode<Key, Value, Sized>* m = t->getRight();
+        int hml, hmr;
+        child_heights(m, ht - 1, hml, hmr);
+        int htl = ht - 2;
+        rotate_left(t);
+        rotate_right(r);
+        r->setBalance(static_cast<int8_t>(hrr - hmr));
+        t->setBalance(static_cast<int8_t>(hml - htl));
+        int hNewR = std::max(hmr, hrr) + 1;
+        int hNewT = std::max(htl, hml) + 1;
+        m->setBalance(static_cast<int8_t>(hNewR - hNewT));
+        h = std::max(hNewT, hNewR) + 1;
+        return m;
+    }
+}
+
+// Joins two detached subtrees without a key in between, by pulling the last
+// node out of l to use as one
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>*
+AVLTree<Key, Value, Compare, Sized>::join2_nodes(AVLNode<Key, Value, Sized>* l,
+                                                 int hl,
+                                                 AVLNode<Key, Value, Sized>* r,
+                                                 int hr, int& h) {
+    if (l == nullptr) {
+        h = hr;
+        return r;
+    }
+    if (r == nullptr) {
+        h = hl;
+        return l;
+    }
+    AVLNode<Key, Value, Sized>* rest;
+    int hrest;
+    AVLNode<Key, Value, Sized>* last = split_last(l, hl, rest, hrest);
+    return join_nodes(rest, hrest, last, r, hr, h);
+}
+
+// Recursive helper function for join2_nodes. Removes the last node from the
+// detached subtree t and returns it, leaving the remaining nodes in rest.
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>* AVLTree<Key, Value, Compare, Sized>::split_last(
+    AVLNode<Key, Value, Sized>* t, int ht, AVLNode<Key, Value, Sized>*& rest,
+    int& hrest) {
+    if (t->getRight() == nullptr) {
+        rest = detach(t->getLeft());
+        hrest = ht - 1;
+        t->setLeft(nullptr);
+        return t;
+    }
+    int htl, htr;
+    child_heights(t, ht, htl, htr);
+    AVLNode<Key, Value, Sized>* tl = detach(t->getLeft());
+    AVLNode<Key, Value, Sized>* tr = detach(t->getRight());
+    AVLNode<Key, Value, Sized>* restRight;
+    int hrestRight;
+    AVLNode<Key, Value, Sized>* last =
+        split_last(tr, htr, restRight, hrestRight);
+    rest = join_nodes(tl, htl, t, restRight, hrestRight, hrest);
+    return last;
+}
+
+// Recursive helper function for split. Splits the detached subtree t into the
+// nodes with keys less than key (l), the node with key itself if there is one
+// (mid), and the nodes with greater keys (r).
+template <class Key, class Value, class Compare, bool Sized>
+void AVLTree<Key, Value, Compare, Sized>::split_nodes(
+    AVLNode<Key, Value, Sized>* t, int ht, const Key& key,
+    AVLNode<Key, Value, Sized>*& l, int& hl, AVLNode<Key, Value, Sized>*& mid,
+    AVLNode<Key, Value, Sized>*& r, int& hr) {
+    if (t == nullptr) {
+        l = r = mid = nullptr;
+        hl = hr = 0;
+        return;
+    }
+    int htl, htr;
+    child_heights(t, ht, htl, htr);
+    AVLNode<Key, Value, Sized>* tl = detach(t->getLeft());
+    AVLNode<Key, Value, Sized>* tr = detach(t->getRight());
+    if (this->comp_(key, t->getKey())) {
+        AVLNode<Key, Value, Sized>* rest;
+        int hrest;
+        split_nodes(tl, htl, key, l, hl, mid, rest, hrest);
+        r = join_nodes(rest, hrest, t, tr, htr, hr);
+    } else if (this->comp_(t->getKey(), key)) {
+        AVLNode<Key, Value, Sized>* rest;
+        int hrest;
+        split_nodes(tr, htr, key, rest, hrest, mid, r, hr);
+        l = join_nodes(tl, htl, t, rest, hrest, hl);
+    } else {
+        l = tl;
+        hl = htl;
+        r = tr;
+        hr = htr;
+        t->setLeft(nullptr);
+        t->setRight(nullptr);
+        mid = t;
+    }
+}
+
+// Recursive helper function for union_with. Splits a around the root of b,
+// unites the halves with b's subtrees and joins them back with b's root.
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>*
+AVLTree<Key, Value, Compare, Sized>::union_nodes(AVLNode<Key, Value, Sized>* a,
+                                                 int ha,
+                                                 AVLNode<Key, Value, Sized>* b,
+                                                 int hb, int& h,
+                                                 const Fork* fork) {
+    if (a == nullptr) {
+        h = hb;
+        return b;
+    }
+    if (b == nullptr) {
+        h = ha;
+        return a;
+    }
+    std::size_t work = min_size(ha) + min_size(hb);
+    int hbl, hbr;
+    child_heights(b, hb, hbl, hbr);
+    AVLNode<Key, Value, Sized>* bl = detach(b->getLeft());
+    AVLNode<Key, Value, Sized>* br = detach(b->getRight());
+    AVLNode<Key, Value, Sized>* al;
+    AVLNode<Key, Value, Sized>* mid;
+    AVLNode<Key, Value, Sized>* ar;
+    int hal, har;
+    split_nodes(a, ha, b->getKey(), al, hal, mid, ar, har);
+    if (mid != nullptr) {
+        // b's value wins
+        this->destroy_node(mid);
+    }
+    int hLeft, hRight;
+    AVLNode<Key, Value, Sized>* left;
+    AVLNode<Key, Value, Sized>* right;
+    fork_join(
+        fork, work,
+        [&] { left = union_nodes(al, hal, bl, hbl, hLeft, fork); },
+        [&] { right = union_nodes(ar, har, br, hbr, hRight, fork); });
+    return join_nodes(left, hLeft, b, right, hRight, h);
+}
+
+// Recursive helper function for intersection_with. Nodes from b belong to
+// other and are freed by it.
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>*
+AVLTree<Key, Value, Compare, Sized>::intersection_nodes(
+    AVLNode<Key, Value, Sized>* a, int ha, AVLNode<Key, Value, Sized>* b,
+    int hb, AVLTree<Key, Value, Compare, Sized>& other, int& h,
+    const Fork* fork) {
+    if (a == nullptr || b == nullptr) {
+        this->clear_helper(a);
+        other.clear_helper(b);
+        h = 0;
+        return nullptr;
+    }
+    std::size_t work = min_size(ha) + min_size(hb);
+    int hal, har;
+    child_heights(a, ha, hal, har);
+    AVLNode<Key, Value, Sized>* al = detach(a->getLeft());
+    AVLNode<Key, Value, Sized>* ar = detach(a->getRight());
+    AVLNode<Key, Value, Sized>* bl;
+    AVLNode<Key, Value, Sized>* mid;
+    AVLNode<Key, Value, Sized>* br;
+    int hbl, hbr;
+    split_nodes(b, hb, a->getKey(), bl, hbl, mid, br, hbr);
+    int hLeft, hRight;
+    AVLNode<Key, Value, Sized>* left;
+    AVLNode<Key, Value, Sized>* right;
+    fork_join(
+        fork, work,
+        [&] {
+            left = intersection_nodes(al, hal, bl, hbl, other, hLeft, fork);
+        },
+        [&] {
+            right = intersection_nodes(ar, har, br, hbr, other, hRight, fork);
+        });
+    if (mid != nullptr) {
+        other.destroy_node(mid);
+        return join_nodes(left, hLeft, a, right, hRight, h);
+    }
+    this->destroy_node(a);
+    return join2_nodes(left, hLeft, right, hRight, h);
+}
+
+// Recursive helper function for difference_with. Nodes from b belong to other
+// and are freed by it.
+template <class Key, class Value, class Compare, bool Sized>
+AVLNode<Key, Value, Sized>*
+AVLTree<Key, Value, Compare, Sized>::difference_nodes(
+    AVLNode<Key, Value, Sized>* a, int ha, AVLNode<Key, Value, Sized>* b,
+    int hb, AVLTree<Key, Value, Compare, Sized>& other, int& h,
+    const Fork* fork) {
+    if (a == nullptr || b == nullptr) {
+        other.clear_helper(b);
+        h = ha;
+        return a;
+    }
+    std::size_t work = min_size(ha) + min_size(hb);
+    int hbl, hbr;
+    child_heights(b, hb, hbl, hbr);
+    AVLNode<Key, Value, Sized>* bl = detach(b->getLeft());
+    AVLNode<Key, Value, Sized>* br = detach(b->getRight());
+    AVLNode<Key, Value, Sized>* al;
+    AVLNode<Key, Value, Sized>* mid;
+    AVLNode<Key, Value, Sized>* ar;
+    int hal, har;
+    split_nodes(a, ha, b->getKey(), al, hal, mid, ar, har);
+    if (mid != nullptr) {
+        this->destroy_node(mid);
+    }
+    b->setLeft(nullptr);
+    b->setRight(nullptr);
+    other.destroy_node(b);
+    int hLeft, hRight;
+    AVLNode<Key, Value, Sized>* left;
+    AVLNode<Key, Value, Sized>* right;
+    fork_join(
+        fork, work,
+        [&] {
+            left = difference_nodes(al, hal, bl, hbl, other, hLeft, fork);
+        },
+        [&] {
+            right = difference_nodes(ar, har, br, hbr, other, hRight, fork);
+        });
+    return join2_nodes(left, hLeft, right, hRight, h);
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for join, split and set operations.
+  ---------------------------------------------------
+*/
+
 #endif
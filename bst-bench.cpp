@@ -0,0 +1,1173 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "task_pool.h"
+#include "concurrent_avlbst.h"
+#include "sharded_avlbst.h"
+#include "frozen_bst.h"
+#include "static_btree.h"
+#include "veb_tree.h"
+#include "compact_avlbst.h"
+#include "rbbst.h"
+#include "splaybst.h"
+#include "scapegoatbst.h"
+
+using namespace std;
+
+// Benchmarks for the search trees. Run with the name of a benchmark and
+// optionally a problem size, e.g. "./bst-bench alloc 1000000".
+
+typedef chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+void report(const string& what, size_t ops, double secs)
+{
+    cout << "  " << what << ": " << secs * 1000 << " ms ("
+         << ops / secs / 1e6 << " Mops/s)" << endl;
+}
+
+vector<int> shuffledKeys(size_t n, unsigned seed = 1)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; i++) {
+        keys[i] = (int)i;
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(seed));
+    return keys;
+}
+
+// Inserts, erases half of, and clears a tree, either with the default heap
+// allocator or with a pool of its own.
+template <class Tree>
+void allocRound(const string& name, const vector<int>& keys, bool pooled)
+{
+    Tree tree;
+    if(pooled) {
+        tree.setAllocator(make_shared<PoolNodeAllocator>());
+    }
+    cout << name << endl;
+
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("insert", keys.size(), secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < keys.size(); i += 2) {
+        tree.remove(keys[i]);
+    }
+    report("erase", keys.size() / 2, secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < keys.size(); i += 2) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("reinsert", keys.size() / 2, secondsSince(start));
+
+    start = Clock::now();
+    tree.clear();
+    report("clear", keys.size(), secondsSince(start));
+}
+
+void benchAlloc(size_t n)
+{
+    vector<int> keys = shuffledKeys(n);
+    allocRound<BinarySearchTree<int, int> >("BST, heap", keys, false);
+    allocRound<BinarySearchTree<int, int> >("BST, pool", keys, true);
+    allocRound<AVLTree<int, int> >("AVL, heap", keys, false);
+    allocRound<AVLTree<int, int> >("AVL, pool", keys, true);
+}
+
+// Random inserts followed by lookups of every key.
+template <class Tree>
+void lookupRound(const string& name, const vector<int>& keys)
+{
+    Tree tree;
+    cout << name << endl;
+
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("insert", keys.size(), secondsSince(start));
+
+    vector<int> probes = shuffledKeys(keys.size(), 2);
+    long sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        sum += tree.find(probes[i])->second;
+    }
+    report("find", probes.size(), secondsSince(start));
+
+    start = Clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        sum += it->second;
+    }
+    report("iterate", keys.size(), secondsSince(start));
+    if(sum == 42) {
+        cout << "";
+    }
+}
+
+void benchLookup(size_t n)
+{
+    vector<int> keys = shuffledKeys(n);
+    lookupRound<BinarySearchTree<int, int> >("BST", keys);
+    lookupRound<AVLTree<int, int> >("AVL", keys);
+}
+
+// Builds a list-shaped BST from sorted keys. Every operation here used to
+// recurse once per level, so this overflowed the stack long before it got
+// slow. Inserting sorted keys is still quadratic, so keep n modest. Then
+// rebalances it, and loads the keys again into a tree that rebalances itself
+// as it goes (setAutoRebalance).
+void benchSorted(size_t n)
+{
+    BinarySearchTree<int, int> tree;
+    cout << "BST, " << n << " sorted keys" << endl;
+
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(make_pair((int)i, (int)i));
+    }
+    report("insert", n, secondsSince(start));
+
+    start = Clock::now();
+    bool found = tree.find((int)n - 1) != tree.end();
+    report("find deepest", 1, secondsSince(start));
+
+    start = Clock::now();
+    bool balanced = tree.isBalanced();
+    report("isBalanced", n, secondsSince(start));
+
+    start = Clock::now();
+    tree.rebalance();
+    report("rebalance", n, secondsSince(start));
+
+    start = Clock::now();
+    found = found && tree.find((int)n - 1) != tree.end();
+    report("find deepest", 1, secondsSince(start));
+    bool rebalanced = tree.isBalanced();
+
+    start = Clock::now();
+    tree.clear();
+    report("clear", n, secondsSince(start));
+    cout << "  found: " << found << ", balanced: " << balanced
+         << ", after rebalance: " << rebalanced << endl;
+
+    BinarySearchTree<int, int, std::less<int>, true> autoTree;
+    autoTree.setAutoRebalance(2);
+    start = Clock::now();
+    for(size_t i = 0; i < n; i++) {
+        autoTree.insert(make_pair((int)i, (int)i));
+    }
+    report("insert, setAutoRebalance(2)", n, secondsSince(start));
+}
+
+// Loading an AVL tree from a sorted snapshot, one insert at a time versus
+// build_from_sorted.
+void benchBuild(size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; i++) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+    cout << "AVL, " << n << " sorted items" << endl;
+
+    AVLTree<int, int> inserted;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; i++) {
+        inserted.insert(items[i]);
+    }
+    report("insert loop", n, secondsSince(start));
+
+    AVLTree<int, int> built;
+    start = Clock::now();
+    built.build_from_sorted(items.begin(), items.end());
+    report("build_from_sorted", n, secondsSince(start));
+}
+
+// Applying batches of updates to an AVL tree of n keys, pair by pair versus
+// insert_batch, for small and large batches.
+void benchBatch(size_t n)
+{
+    vector<int> keys = shuffledKeys(n);
+    mt19937 rng(3);
+    size_t batchSizes[] = {1000, 10000, n};
+    for(size_t b = 0; b < 3; b++) {
+        vector<pair<int, int> > batch(batchSizes[b]);
+        for(size_t i = 0; i < batch.size(); i++) {
+            int key = (int)(rng() % (2 * n));
+            batch[i] = make_pair(key, key);
+        }
+        cout << "AVL, " << n << " keys, batch of " << batch.size() << endl;
+
+        AVLTree<int, int> looped, batched;
+        for(size_t i = 0; i < n; i++) {
+            looped.insert(make_pair(keys[i], keys[i]));
+            batched.insert(make_pair(keys[i], keys[i]));
+        }
+
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < batch.size(); i++) {
+            looped.insert(batch[i]);
+        }
+        report("insert loop", batch.size(), secondsSince(start));
+
+        start = Clock::now();
+        batched.insert_batch(batch.begin(), batch.end());
+        report("insert_batch", batch.size(), secondsSince(start));
+    }
+}
+
+// Builds two AVL trees of n keys each, with every other key in common.
+void buildMergeInputs(size_t n, AVLTree<int, int>& a, AVLTree<int, int>& b)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; i++) {
+        items[i] = make_pair((int)(2 * i), (int)i);
+    }
+    a.build_from_sorted(items.begin(), items.end());
+    for(size_t i = 0; i < n; i++) {
+        items[i] = make_pair((int)(3 * i), (int)i);
+    }
+    b.build_from_sorted(items.begin(), items.end());
+}
+
+// Merging two AVL trees by reinserting versus with union_with, plus the other
+// set operations.
+void benchMerge(size_t n)
+{
+    cout << "AVL, two trees of " << n << " keys" << endl;
+    AVLTree<int, int> a, b;
+
+    buildMergeInputs(n, a, b);
+    Clock::time_point start = Clock::now();
+    for(AVLTree<int, int>::iterator it = b.begin(); it != b.end(); ++it) {
+        a.insert(*it);
+    }
+    report("reinsert loop", n, secondsSince(start));
+
+    buildMergeInputs(n, a, b);
+    start = Clock::now();
+    a.union_with(b);
+    report("union_with", n, secondsSince(start));
+
+    buildMergeInputs(n, a, b);
+    start = Clock::now();
+    a.intersection_with(b);
+    report("intersection_with", n, secondsSince(start));
+
+    buildMergeInputs(n, a, b);
+    start = Clock::now();
+    a.difference_with(b);
+    report("difference_with", n, secondsSince(start));
+
+    // All remaining keys are even, so an odd key can be joined back in
+    AVLTree<int, int> left, right;
+    int middle = (int)n | 1;
+    start = Clock::now();
+    a.split(middle, left, right);
+    a.join(left, make_pair(middle, 0), right);
+    report("split + join", 1, secondsSince(start));
+}
+
+// Scaling of the parallel set operations with the number of threads, from 1
+// up to twice the hardware threads.
+void benchParallel(size_t n)
+{
+    unsigned hardware = thread::hardware_concurrency();
+    cout << "AVL, two trees of " << n << " keys, " << hardware
+         << " hardware threads" << endl;
+    AVLTree<int, int> a, b;
+
+    buildMergeInputs(n, a, b);
+    Clock::time_point start = Clock::now();
+    a.union_with(b);
+    double serial = secondsSince(start);
+    report("serial union_with", n, serial);
+
+    for(unsigned threads = 1; threads <= 2 * max(hardware, 1u); threads *= 2) {
+        TaskPool pool(threads);
+        cout << threads << " threads" << endl;
+
+        buildMergeInputs(n, a, b);
+        start = Clock::now();
+        a.union_with(b, pool);
+        double secs = secondsSince(start);
+        report("union_with", n, secs);
+        cout << "  speedup over serial: " << serial / secs << endl;
+
+        buildMergeInputs(n, a, b);
+        start = Clock::now();
+        a.intersection_with(b, pool);
+        report("intersection_with", n, secondsSince(start));
+
+        buildMergeInputs(n, a, b);
+        start = Clock::now();
+        a.difference_with(b, pool);
+        report("difference_with", n, secondsSince(start));
+    }
+}
+
+// An AVLTree behind one mutex, the way it used to be shared
+class LockedAVLTree
+{
+public:
+    void insert(const pair<const int, int>& item)
+    {
+        lock_guard<mutex> guard(lock_);
+        tree_.insert(item);
+    }
+    void remove(int key)
+    {
+        lock_guard<mutex> guard(lock_);
+        tree_.remove(key);
+    }
+    bool find(int key, int& value)
+    {
+        lock_guard<mutex> guard(lock_);
+        AVLTree<int, int>::iterator it = tree_.find(key);
+        if(it == tree_.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+    template <class InputIt>
+    void insert_batch(InputIt first, InputIt last)
+    {
+        lock_guard<mutex> guard(lock_);
+        tree_.insert_batch(first, last);
+    }
+
+private:
+    mutex lock_;
+    AVLTree<int, int> tree_;
+};
+
+// Each thread does opsPerThread operations on keys in [0, 2n), of which one
+// in writeEvery is an insert or remove and the rest are finds.
+template <class Tree>
+void mixedRound(const string& name, Tree& tree, size_t n, unsigned threads,
+                size_t opsPerThread, unsigned writeEvery)
+{
+    vector<thread> workers;
+    Clock::time_point start = Clock::now();
+    for(unsigned t = 0; t < threads; t++) {
+        workers.push_back(thread([&tree, n, t, opsPerThread, writeEvery]() {
+            mt19937 rng(t + 1);
+            long sum = 0;
+            for(size_t i = 0; i < opsPerThread; i++) {
+                int key = (int)(rng() % (2 * n));
+                int value;
+                if(i % writeEvery != 0) {
+                    if(tree.find(key, value)) {
+                        sum += value;
+                    }
+                }
+                else if(rng() % 2) {
+                    tree.insert(make_pair(key, key));
+                }
+                else {
+                    tree.remove(key);
+                }
+            }
+            if(sum == 42) {
+                cout << "";
+            }
+        }));
+    }
+    for(size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    report(name, threads * opsPerThread, secondsSince(start));
+}
+
+// Throughput of a shared tree of n keys under a read-mostly mix, from 1 to
+// 64 threads, for ConcurrentAVLTree and a mutex around an AVLTree.
+void benchConcurrent(size_t n)
+{
+    const size_t opsPerThread = 200000;
+    const unsigned writeEvery = 10;
+    cout << "Shared AVL tree of " << n << " keys, 1 write in " << writeEvery
+         << " ops, " << thread::hardware_concurrency()
+         << " hardware threads" << endl;
+
+    ConcurrentAVLTree<int, int> concurrent;
+    LockedAVLTree locked;
+    vector<int> keys = shuffledKeys(n);
+    for(size_t i = 0; i < n; i++) {
+        concurrent.insert(make_pair(2 * keys[i], keys[i]));
+        locked.insert(make_pair(2 * keys[i], keys[i]));
+    }
+
+    for(unsigned threads = 1; threads <= 64; threads *= 2) {
+        cout << threads << " threads" << endl;
+        mixedRound("ConcurrentAVLTree", concurrent, n, threads, opsPerThread,
+                   writeEvery);
+        mixedRound("AVLTree + mutex", locked, n, threads, opsPerThread,
+                   writeEvery);
+    }
+}
+
+// Each of the threads ingests its own share of n random keys, in batches of
+// batchSize, into a freshly made Map.
+template <class Map>
+void ingestRound(const string& name, Map& map, size_t n, unsigned threads,
+                 size_t batchSize)
+{
+    vector<thread> workers;
+    Clock::time_point start = Clock::now();
+    for(unsigned t = 0; t < threads; t++) {
+        workers.push_back(thread([&map, n, t, threads, batchSize]() {
+            mt19937 rng(t + 1);
+            vector<pair<int, int> > batch;
+            for(size_t i = 0; i < n / threads; i++) {
+                int key = (int)rng();
+                batch.push_back(make_pair(key, key));
+                if(batch.size() == batchSize) {
+                    map.insert_batch(batch.begin(), batch.end());
+                    batch.clear();
+                }
+            }
+            map.insert_batch(batch.begin(), batch.end());
+        }));
+    }
+    for(size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    report(name, n, secondsSince(start));
+}
+
+// Ingest throughput of n keys from 1 to 64 threads into a ShardedAVLMap,
+// hashed and by range, versus a single AVLTree behind a mutex.
+void benchSharded(size_t n)
+{
+    const size_t shards = 64;
+    const size_t batchSize = 1000;
+    cout << "Ingesting " << n << " keys in batches of " << batchSize << ", "
+         << shards << " shards, " << thread::hardware_concurrency()
+         << " hardware threads" << endl;
+
+    // Keys are uniform over all ints, so split that range evenly
+    vector<int> splitKeys;
+    for(size_t i = 1; i < shards; i++) {
+        splitKeys.push_back((int)(INT32_MIN + (int64_t)i * (1LL << 32) /
+                                                 (int64_t)shards));
+    }
+
+    for(unsigned threads = 1; threads <= 64; threads *= 2) {
+        cout << threads << " threads" << endl;
+        ShardedAVLMap<int, int> hashed(shards);
+        ingestRound("ShardedAVLMap, hash", hashed, n, threads, batchSize);
+        ShardedAVLMap<int, int> ranged(splitKeys);
+        ingestRound("ShardedAVLMap, range", ranged, n, threads, batchSize);
+        LockedAVLTree locked;
+        ingestRound("AVLTree + mutex", locked, n, threads, batchSize);
+    }
+}
+
+// Random lookups in an AVL tree of n keys versus a frozen copy of it. The
+// difference shows once the tree is well beyond the last level cache.
+// Fills tree with the even keys below 2n, with half of the nodes scattered
+// over the heap the way random inserts would leave them.
+void buildScattered(size_t n, AVLTree<int, int>& tree)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; i++) {
+        items[i] = make_pair((int)(2 * i), (int)i);
+    }
+    tree.build_from_sorted(items.begin(), items.end());
+    vector<int> keys = shuffledKeys(n);
+    for(size_t i = 0; i < n; i += 2) {
+        tree.remove(2 * keys[i]);
+    }
+    for(size_t i = 0; i < n; i += 2) {
+        tree.insert(make_pair(2 * keys[i], keys[i]));
+    }
+}
+
+void benchFrozen(size_t n)
+{
+    AVLTree<int, int> tree;
+    buildScattered(n, tree);
+    cout << "AVL, " << n << " keys" << endl;
+
+    Clock::time_point start = Clock::now();
+    FrozenTree<int, int> frozen = freeze(tree);
+    report("freeze", n, secondsSince(start));
+
+    // Half of the probes miss
+    vector<int> probes = shuffledKeys(2 * n, 2);
+    long sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        AVLTree<int, int>::iterator it = tree.find(probes[i]);
+        if(it != tree.end()) {
+            sum += it->second;
+        }
+    }
+    report("AVLTree::find", probes.size(), secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        FrozenTree<int, int>::iterator it = frozen.find(probes[i]);
+        if(it != frozen.end()) {
+            sum -= it->second;
+        }
+    }
+    report("FrozenTree::find", probes.size(), secondsSince(start));
+
+    start = Clock::now();
+    for(FrozenTree<int, int>::iterator it = frozen.begin(); it != frozen.end();
+        ++it) {
+        sum += it->second;
+    }
+    report("FrozenTree iterate", n, secondsSince(start));
+    if(sum == 42) {
+        cout << "";
+    }
+}
+
+// Times lookups of the probes and returns a checksum of what was found
+template <class Tree>
+long probeRound(const string& name, const Tree& tree,
+                const vector<int>& probes)
+{
+    long sum = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        typename Tree::iterator it = tree.find(probes[i]);
+        if(it != tree.end()) {
+            sum += it->second;
+        }
+    }
+    report(name, probes.size(), secondsSince(start));
+    return sum;
+}
+
+// Keys are the even numbers below 2n, so half of the probes miss
+void btreeRound(size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; i++) {
+        items[i] = make_pair((int)(2 * i), (int)i);
+    }
+    cout << n << " keys" << endl;
+    vector<int> probes = shuffledKeys(2 * n, 2);
+    BinarySearchTree<int, int> tree;
+    tree.build_from_sorted(items.begin(), items.end());
+    long sum = probeRound("BinarySearchTree::find", tree, probes);
+
+    Clock::time_point start = Clock::now();
+    StaticBTree<int, int> btree(tree);
+    report("StaticBTree build", n, secondsSince(start));
+    sum -= probeRound("StaticBTree::find", btree, probes);
+    if(sum == 42) {
+        cout << "";
+    }
+}
+
+// Lookups in a static B+ tree versus a balanced BinarySearchTree, at 1M and
+// 10M keys, or just n if given. For "btree 100000000", the pointer-based
+// tree alone needs about 5 GB.
+void benchBTree(size_t n)
+{
+#if defined(__AVX2__)
+    cout << "StaticBTree using AVX2" << endl;
+#elif defined(__SSE2__)
+    cout << "StaticBTree using SSE2" << endl;
+#else
+    cout << "StaticBTree using scalar code" << endl;
+#endif
+    if(n) {
+        btreeRound(n);
+    }
+    else {
+        btreeRound(1000000);
+        btreeRound(10000000);
+    }
+}
+
+// Lookups in an AVL tree versus a van Emde Boas compacted copy, before and
+// after a round of updates that go through the copy's overflow tree.
+void benchVeb(size_t n)
+{
+    AVLTree<int, int> tree;
+    buildScattered(n, tree);
+    cout << "AVL, " << n << " keys" << endl;
+
+    Clock::time_point start = Clock::now();
+    VebTree<int, int> veb(tree);
+    report("compact", n, secondsSince(start));
+
+    vector<int> probes = shuffledKeys(2 * n, 2);
+    long sum = probeRound("AVLTree::find", tree, probes);
+    sum -= probeRound("VebTree::find", veb, probes);
+
+    // Updates of new odd keys and removals of existing even ones
+    mt19937 rng(4);
+    size_t updates = n / 10;
+    start = Clock::now();
+    for(size_t i = 0; i < updates; i++) {
+        int key = (int)(rng() % (2 * n));
+        if(key % 2) {
+            veb.insert(make_pair(key, key));
+        }
+        else {
+            veb.remove(key);
+        }
+    }
+    report("VebTree updates", updates, secondsSince(start));
+    cout << "  " << veb.overflow_size() << " items in overflow" << endl;
+    sum += probeRound("VebTree::find after updates", veb, probes);
+    if(sum == 42) {
+        cout << "";
+    }
+}
+
+// Random inserts, lookups and iteration over n <uint32_t, uint32_t> items in
+// an AVLTree on a pool and in a CompactAVLTree, with the memory each used.
+template <class Tree>
+void compactRound(const string& name, Tree& tree, const vector<int>& keys)
+{
+    cout << name << endl;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(make_pair((uint32_t)keys[i], (uint32_t)i));
+    }
+    report("insert", keys.size(), secondsSince(start));
+
+    long sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < keys.size(); i++) {
+        sum += tree.find((uint32_t)keys[keys.size() - 1 - i])->second;
+    }
+    report("find", keys.size(), secondsSince(start));
+
+    start = Clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        sum += it->second;
+    }
+    report("iterate", keys.size(), secondsSince(start));
+    if(sum == 42) {
+        cout << "";
+    }
+}
+
+void benchCompact(size_t n)
+{
+    vector<int> keys = shuffledKeys(n);
+    cout << n << " <uint32_t, uint32_t> items" << endl;
+
+    // A pool keeps malloc's per-block overhead out of the comparison
+    shared_ptr<PoolNodeAllocator> pool = make_shared<PoolNodeAllocator>();
+    {
+        AVLTree<uint32_t, uint32_t> tree;
+        tree.setAllocator(pool);
+        compactRound("AVLTree, pool", tree, keys);
+    }
+    cout << "  node: " << sizeof(AVLNode<uint32_t, uint32_t>) << " bytes, "
+         << "about " << sizeof(AVLNode<uint32_t, uint32_t>) * n / 1000000
+         << " MB in all" << endl;
+
+    CompactAVLTree<uint32_t, uint32_t> compact;
+    compactRound("CompactAVLTree", compact, keys);
+    cout << "  " << compact.memory_used() / 1000000 << " MB in all, "
+         << (double)compact.memory_used() / n << " bytes per item" << endl;
+}
+
+#ifdef BST_COUNT_WRITES
+// A snapshot of the node store counters
+struct WriteCounts {
+    unsigned long long total;
+    unsigned long long fields[NODE_FIELDS];
+};
+
+WriteCounts writeCounts()
+{
+    WriteCounts counts;
+    counts.total = node_writes();
+    for(int f = 0; f < NODE_FIELDS; f++) {
+        counts.fields[f] = node_writes((NodeField)f);
+    }
+    return counts;
+}
+
+// Prints the node stores per operation since before, in total and split by
+// field. Engines keep different fields, so only like fields compare: a
+// CompactAVLTree has no parent links to keep up to date, and only trees
+// made Sized store subtree sizes.
+void reportWrites(const WriteCounts& before, size_t ops, const string& what)
+{
+    static const char* const fieldNames[NODE_FIELDS] = {
+        "child links", "parent links", "sizes", "balances"
+    };
+    WriteCounts now = writeCounts();
+    cout << "    " << (double)(now.total - before.total) / ops
+         << " node stores per " << what << ":";
+    for(int f = 0; f < NODE_FIELDS; f++) {
+        cout << (f ? ", " : " ")
+             << (double)(now.fields[f] - before.fields[f]) / ops << " "
+             << fieldNames[f];
+    }
+    cout << endl;
+}
+#endif
+
+// Inserts keys, then replaces half of them one at a time, reporting the time
+// and, in a build with BST_COUNT_WRITES, the node stores per operation.
+template <class Tree>
+void writesRound(const string& name, Tree& tree, const vector<int>& keys)
+{
+    cout << name << endl;
+    const size_t half = keys.size() / 2;
+#ifdef BST_COUNT_WRITES
+    WriteCounts before = writeCounts();
+#endif
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < half; i++) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("insert", half, secondsSince(start));
+#ifdef BST_COUNT_WRITES
+    reportWrites(before, half, "insert");
+    before = writeCounts();
+#endif
+
+    // Keep the size steady: every new key pushes out an old one
+    start = Clock::now();
+    for(size_t i = half; i < keys.size(); i++) {
+        tree.insert(make_pair(keys[i], keys[i]));
+        tree.remove(keys[i - half]);
+    }
+    report("insert + remove", keys.size() - half, secondsSince(start));
+#ifdef BST_COUNT_WRITES
+    reportWrites(before, keys.size() - half, "insert + remove");
+#endif
+}
+
+void benchWrites(size_t n)
+{
+#ifndef BST_COUNT_WRITES
+    cout << "(build bst-writes to count node stores as well)" << endl;
+#endif
+    vector<int> random = shuffledKeys(n);
+    vector<int> ascending(n);
+    for(size_t i = 0; i < n; i++) {
+        ascending[i] = (int)i;
+    }
+    const vector<int>* orders[] = { &random, &ascending };
+    const char* names[] = { "random keys", "ascending keys" };
+    for(int o = 0; o < 2; o++) {
+        cout << "-- " << names[o] << endl;
+        shared_ptr<PoolNodeAllocator> pool = make_shared<PoolNodeAllocator>();
+        {
+            AVLTree<int, int> tree;
+            tree.setAllocator(pool);
+            writesRound("AVLTree, pool", tree, *orders[o]);
+        }
+        CompactAVLTree<int, int> compact;
+        writesRound("CompactAVLTree", compact, *orders[o]);
+    }
+}
+
+// Inserts keys and then removes them all in another order, reporting the
+// time and, in a build with BST_COUNT_WRITES, the rotations per operation.
+template <class Tree>
+void rotationsRound(const string& name, const vector<int>& keys,
+                    const vector<int>& removals)
+{
+    Tree tree;
+    tree.setAllocator(make_shared<PoolNodeAllocator>());
+    cout << name << endl;
+#ifdef BST_COUNT_WRITES
+    unsigned long long before = rotations();
+#endif
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("insert", keys.size(), secondsSince(start));
+#ifdef BST_COUNT_WRITES
+    cout << "    " << (double)(rotations() - before) / keys.size()
+         << " rotations per insert" << endl;
+    before = rotations();
+#endif
+
+    start = Clock::now();
+    for(size_t i = 0; i < removals.size(); i++) {
+        tree.remove(removals[i]);
+    }
+    report("remove", removals.size(), secondsSince(start));
+#ifdef BST_COUNT_WRITES
+    cout << "    " << (double)(rotations() - before) / removals.size()
+         << " rotations per remove" << endl;
+#endif
+}
+
+void benchRBTree(size_t n)
+{
+#ifndef BST_COUNT_WRITES
+    cout << "(build bst-writes to count rotations as well)" << endl;
+#endif
+    vector<int> random = shuffledKeys(n);
+    vector<int> ascending(n);
+    for(size_t i = 0; i < n; i++) {
+        ascending[i] = (int)i;
+    }
+    vector<int> removals = shuffledKeys(n, 2);
+    const vector<int>* orders[] = { &random, &ascending };
+    const char* names[] = { "random keys", "ascending keys" };
+    for(int o = 0; o < 2; o++) {
+        cout << "-- " << names[o] << ", removed in random order" << endl;
+        rotationsRound<AVLTree<int, int> >("AVLTree", *orders[o], removals);
+        rotationsRound<RBTree<int, int> >("RBTree", *orders[o], removals);
+    }
+}
+
+// Draws count keys out of n from a Zipf distribution with exponent s: the
+// key of rank r comes up with probability proportional to 1 / r^s. Ranks are
+// mapped to keys at random, so that the hot keys are spread over the tree.
+vector<int> zipfKeys(size_t n, size_t count, double s)
+{
+    vector<double> weights(n);
+    for(size_t r = 0; r < n; r++) {
+        weights[r] = 1 / pow((double)(r + 1), s);
+    }
+    discrete_distribution<size_t> rank(weights.begin(), weights.end());
+    vector<int> keyOfRank = shuffledKeys(n, 7);
+    mt19937 rng(8);
+    vector<int> keys(count);
+    for(size_t i = 0; i < count; i++) {
+        keys[i] = keyOfRank[rank(rng)];
+    }
+    return keys;
+}
+
+template <class Tree>
+void zipfRound(const string& name, Tree& tree, const vector<int>& probes)
+{
+    long sum = 0;
+#ifdef BST_COUNT_WRITES
+    unsigned long long before = rotations();
+#endif
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        sum += tree.find(probes[i])->second;
+    }
+    report(name, probes.size(), secondsSince(start));
+#ifdef BST_COUNT_WRITES
+    cout << "    " << (double)(rotations() - before) / probes.size()
+         << " rotations per find" << endl;
+#endif
+    if(sum == 42) {
+        cout << "";
+    }
+}
+
+// Lookups in trees of n keys where about 1% of the keys get 90% of them
+// (Zipf, s = 1.25), in an AVL tree and in splay trees with each of the ways
+// of splaying less. Then the same with every key equally likely, where
+// splaying only costs.
+void benchSplay(size_t n)
+{
+    vector<int> keys = shuffledKeys(n);
+    vector<int> skewed = zipfKeys(n, 2 * n, 1.25);
+    vector<int> uniform = shuffledKeys(n, 2);
+    cout << n << " keys" << endl;
+
+    AVLTree<int, int> avl;
+    SplayTree<int, int> splay;
+    for(size_t i = 0; i < n; i++) {
+        avl.insert(make_pair(keys[i], keys[i]));
+        splay.insert(make_pair(keys[i], keys[i]));
+    }
+    const vector<int>* probes[] = { &skewed, &uniform };
+    const char* names[] = { "Zipf keys", "uniform keys" };
+    for(int p = 0; p < 2; p++) {
+        cout << "-- " << names[p] << endl;
+        zipfRound("AVLTree::find", avl, *probes[p]);
+        splay.setSplayMode(SPLAY_FULL);
+        zipfRound("SplayTree::find", splay, *probes[p]);
+        splay.setSplayMode(SPLAY_SEMI);
+        zipfRound("SplayTree::find, semi-splay", splay, *probes[p]);
+        splay.setSplayMode(SPLAY_FULL, 16);
+        zipfRound("SplayTree::find, every 16th", splay, *probes[p]);
+    }
+}
+
+// Timestamp-like keys that mostly ascend: each is a little past the last, and
+// one in eight arrives late by a few places. Inserted into an AVL tree with
+// plain insert (which starts beside the last insert when it can), with the
+// previous insert's position as a hint, and in random order for comparison.
+// Then looks keys up in ascending order with find and with find_from.
+void benchHint(size_t n)
+{
+    vector<int> stamps(n);
+    mt19937 rng(5);
+    for(size_t i = 0; i < n; i++) {
+        stamps[i] = (int)(4 * i);
+        if(rng() % 8 == 0) {
+            stamps[i] -= (int)(rng() % 64);
+        }
+    }
+    vector<int> random = shuffledKeys(n);
+    cout << "AVL, " << n << " keys" << endl;
+
+    {
+        AVLTree<int, int> tree;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; i++) {
+            tree.insert(make_pair((int)i, (int)i));
+        }
+        report("ascending, insert", n, secondsSince(start));
+    }
+    {
+        AVLTree<int, int> tree;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; i++) {
+            tree.insert(make_pair(stamps[i], (int)i));
+        }
+        report("mostly ascending, insert", n, secondsSince(start));
+    }
+    AVLTree<int, int> tree;
+    Clock::time_point start = Clock::now();
+    AVLTree<int, int>::iterator hint = tree.end();
+    for(size_t i = 0; i < n; i++) {
+        hint = tree.insert(hint, make_pair(stamps[i], (int)i));
+    }
+    report("mostly ascending, hinted insert", n, secondsSince(start));
+    {
+        AVLTree<int, int> shuffled;
+        start = Clock::now();
+        for(size_t i = 0; i < n; i++) {
+            shuffled.insert(make_pair(random[i], (int)i));
+        }
+        report("random, insert", n, secondsSince(start));
+    }
+
+    size_t probes = n / 4;
+    long sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < probes; i++) {
+        AVLTree<int, int>::iterator it = tree.find((int)(16 * i));
+        sum += it == tree.end() ? 0 : it->second;
+    }
+    report("ascending find", probes, secondsSince(start));
+
+    start = Clock::now();
+    AVLTree<int, int>::iterator finger = tree.begin();
+    for(size_t i = 0; i < probes; i++) {
+        AVLTree<int, int>::iterator it = tree.find_from(finger, (int)(16 * i));
+        if(it != tree.end()) {
+            sum += it->second;
+            finger = it;
+        }
+    }
+    report("ascending find_from", probes, secondsSince(start));
+    if(sum == 42) {
+        cout << "";
+    }
+}
+
+// Looks up keys at random in an AVL tree of n keys, one find at a time and
+// with find_batch in batches the size a request handler would look up
+// together. The default n makes the tree several times the size of a large
+// last-level cache; the nodes are inserted in random order so that they are
+// scattered over the heap, not laid out in key order.
+void benchFindBatch(size_t n)
+{
+    vector<int> keys = shuffledKeys(n);
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    vector<int> probes = shuffledKeys(n, 2);
+    cout << "AVL, " << n << " keys" << endl;
+
+    long sum = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        sum += tree.find(probes[i])->second;
+    }
+    report("find", probes.size(), secondsSince(start));
+
+    size_t batchSizes[] = {16, 64, 512};
+    vector<AVLTree<int, int>::iterator> found(512);
+    for(size_t b = 0; b < 3; b++) {
+        size_t size = batchSizes[b];
+        start = Clock::now();
+        for(size_t i = 0; i + size <= probes.size(); i += size) {
+            tree.find_batch(probes.begin() + i, probes.begin() + i + size,
+                            found.begin());
+            for(size_t j = 0; j < size; j++) {
+                sum += found[j]->second;
+            }
+        }
+        report("find_batch of " + to_string(size), probes.size() / size * size,
+               secondsSince(start));
+    }
+    if(sum == 42) {
+        cout << "";
+    }
+}
+
+// Inserts keys into a tree, looks them all up in another order and removes
+// half of them, timing each.
+template <class Tree>
+void scapegoatRound(const string& name, Tree& tree, const vector<int>& keys,
+                    const vector<int>& probes)
+{
+    cout << name << endl;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("insert", keys.size(), secondsSince(start));
+
+    long sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        sum += tree.find(probes[i])->second;
+    }
+    report("find", probes.size(), secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < probes.size() / 2; i++) {
+        tree.remove(probes[i]);
+    }
+    report("remove half", probes.size() / 2, secondsSince(start));
+    if(sum == 42) {
+        cout << "";
+    }
+}
+
+// The scapegoat tree against the AVL and red-black trees, whose nodes carry
+// balance information it does without, on random and on ascending keys.
+void benchScapegoat(size_t n)
+{
+    vector<int> random = shuffledKeys(n);
+    vector<int> ascending(n);
+    for(size_t i = 0; i < n; i++) {
+        ascending[i] = (int)i;
+    }
+    vector<int> probes = shuffledKeys(n, 2);
+    cout << n << " keys; nodes of " << sizeof(AVLNode<int, int>) << " (AVL), "
+         << sizeof(RBNode<int, int>) << " (RB) and " << sizeof(Node<int, int>)
+         << " (scapegoat) bytes" << endl;
+
+    const vector<int>* orders[] = { &random, &ascending };
+    const char* names[] = { "random keys", "ascending keys" };
+    for(int o = 0; o < 2; o++) {
+        cout << "-- " << names[o] << endl;
+        {
+            AVLTree<int, int> tree;
+            scapegoatRound("AVLTree", tree, *orders[o], probes);
+        }
+        {
+            RBTree<int, int> tree;
+            scapegoatRound("RBTree", tree, *orders[o], probes);
+        }
+        double alphas[] = { 0.7, 0.55 };
+        const char* alphaNames[] = { "0.7", "0.55" };
+        for(int a = 0; a < 2; a++) {
+            ScapegoatTree<int, int> tree;
+            tree.setAlpha(alphas[a]);
+            scapegoatRound(string("ScapegoatTree, alpha ") + alphaNames[a],
+                           tree, *orders[o], probes);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2) {
+        cout << "Usage: " << argv[0] << " <benchmark> [n]" << endl;
+        cout << "Benchmarks: alloc lookup sorted build batch merge parallel concurrent sharded frozen btree veb compact writes hint findbatch rbtree splay scapegoat" << endl;
+        return 1;
+    }
+    string which = argv[1];
+    size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+
+    if(which == "alloc") {
+        benchAlloc(n ? n : 1000000);
+    }
+    else if(which == "lookup") {
+        benchLookup(n ? n : 1000000);
+    }
+    else if(which == "sorted") {
+        benchSorted(n ? n : 50000);
+    }
+    else if(which == "build") {
+        benchBuild(n ? n : 1000000);
+    }
+    else if(which == "batch") {
+        benchBatch(n ? n : 1000000);
+    }
+    else if(which == "merge") {
+        benchMerge(n ? n : 1000000);
+    }
+    else if(which == "parallel") {
+        benchParallel(n ? n : 10000000);
+    }
+    else if(which == "concurrent") {
+        benchConcurrent(n ? n : 1000000);
+    }
+    else if(which == "sharded") {
+        benchSharded(n ? n : 1000000);
+    }
+    else if(which == "frozen") {
+        benchFrozen(n ? n : 10000000);
+    }
+    else if(which == "btree") {
+        benchBTree(n);
+    }
+    else if(which == "veb") {
+        benchVeb(n ? n : 4000000);
+    }
+    else if(which == "compact") {
+        benchCompact(n ? n : 4000000);
+    }
+    else if(which == "writes") {
+        benchWrites(n ? n : 2000000);
+    }
+    else if(which == "hint") {
+        benchHint(n ? n : 1000000);
+    }
+    else if(which == "findbatch") {
+        benchFindBatch(n ? n : 4000000);
+    }
+    else if(which == "rbtree") {
+        benchRBTree(n ? n : 1000000);
+    }
+    else if(which == "splay") {
+        benchSplay(n ? n : 1000000);
+    }
+    else if(which == "scapegoat") {
+        benchScapegoat(n ? n : 1000000);
+    }
+    else {
+        cout << "Unknown benchmark " << which << endl;
+        return 1;
+    }
+    return 0;
+}
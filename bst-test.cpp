@@ -1,10 +1,112 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <iterator>
 #include <map>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
 #include "bst.h"
 #include "avlbst.h"
+#include "compact_avlbst.h"
+#include "aggregate_avlbst.h"
+#include "rbbst.h"
+#include "splaybst.h"
+#include "scapegoatbst.h"
+#include "sharded_avlbst.h"
+#include "concurrent_avlbst.h"
+#include "static_btree.h"
+#include "frozen_bst.h"
+#include "veb_tree.h"
 
 using namespace std;
 
+// Prints a tree's items as key:value, and whether it is still balanced
+template <class Tree>
+void printItems(const string& what, const Tree& tree)
+{
+    cout << what << ":";
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        cout << " " << it->first << ":" << it->second;
+    }
+    cout << (tree.isBalanced() ? "" : " (not balanced)") << endl;
+}
+
+// Whether two trees hold the same items in the same order
+template <class Tree>
+bool sameItems(const Tree& a, const Tree& b)
+{
+    typename Tree::iterator i = a.begin();
+    typename Tree::iterator j = b.begin();
+    for(; i != a.end() && j != b.end(); ++i, ++j) {
+        if(i->first != j->first || i->second != j->second) {
+            return false;
+        }
+    }
+    return i == a.end() && j == b.end();
+}
+
+// Whether a tree holds exactly the items of expected: in order when
+// iterated, and each found by find, where keys just past each one are not
+template <class Tree>
+bool sameAsMap(const Tree& tree, const map<int,int>& expected)
+{
+    typename Tree::iterator it = tree.begin();
+    for(map<int,int>::const_iterator e = expected.begin();
+        e != expected.end(); ++e, ++it) {
+        if(it == tree.end() || it->first != e->first ||
+           it->second != e->second || tree.find(e->first) == tree.end() ||
+           (expected.count(e->first + 1) == 0 &&
+            tree.find(e->first + 1) != tree.end())) {
+            return false;
+        }
+    }
+    return it == tree.end();
+}
+
+// Gives a tree a height(), which the trees themselves don't expose
+template <class Tree>
+class MeasuredTree : public Tree {
+  public:
+    int height() const
+    {
+        return heightBelow(this->root_);
+    }
+
+  private:
+    template <class NodeType>
+    static int heightBelow(NodeType* node)
+    {
+        if(node == nullptr) {
+            return 0;
+        }
+        return 1 + std::max(heightBelow(node->getLeft()),
+                            heightBelow(node->getRight()));
+    }
+};
+
+// A number that keeps count of how many of it are alive, to check that
+// trees destroy everything they hold
+struct Tally {
+    static int live;
+    int n;
+    Tally(int n = 0) : n(n) { live++; }
+    Tally(const Tally& other) : n(other.n) { live++; }
+    ~Tally() { live--; }
+    Tally& operator=(const Tally& other) = default;
+    Tally operator+(const Tally& other) const { return Tally(n + other.n); }
+};
+int Tally::live = 0;
+
+// Fills a tree with the multiples of step up to max, each mapped to itself
+// times scale
+void fillMultiples(AVLTree<int,int>& tree, int step, int max, int scale)
+{
+    for(int k = step; k <= max; k += step) {
+        tree.insert(std::make_pair(k, k * scale));
+    }
+}
 
 int main(int argc, char *argv[])
 {
@@ -44,5 +146,535 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Bulk loading from sorted items
+    std::vector<std::pair<char,int> > sorted;
+    for(char c = 'a'; c <= 'g'; ++c) {
+        sorted.push_back(std::make_pair(c, c - 'a'));
+    }
+    // Keeps subtree sizes, for rank and select
+    typedef AVLTree<char,int,std::less<char>,true> SizedAVLTree;
+    SizedAVLTree bulk;
+    bulk.build_from_sorted(sorted.begin(), sorted.end());
+    cout << "\nBulk loaded AVLTree is " << (bulk.isBalanced() ? "" : "not ")
+         << "balanced" << endl;
+    bulk.print();
+
+    cout << "Keys from c to e:";
+    for(std::pair<const char,int>& item : bulk.range('c', 'e')) {
+        cout << " " << item.first;
+    }
+    cout << endl;
+    cout << "lower_bound(c): " << bulk.lower_bound('c')->first
+         << ", upper_bound(c): " << bulk.upper_bound('c')->first
+         << ", upper_bound(g) is "
+         << (bulk.upper_bound('g') == bulk.end() ? "" : "not ") << "end()"
+         << endl;
+    std::pair<SizedAVLTree::iterator, SizedAVLTree::iterator> eq =
+        bulk.equal_range('d');
+    cout << "equal_range(d) holds " << eq.first->first << " and ends at "
+         << eq.second->first << endl;
+
+    // Order statistics
+    cout << "rank(e): " << bulk.rank('e') << ", select(2): "
+         << bulk.select(2)->first << ", size: " << bulk.size() << endl;
+
+    // Batch insertion: b is overwritten and h inserted, each counted once
+    // although both appear twice in the batch
+    std::vector<std::pair<char,int> > batch;
+    batch.push_back(std::make_pair('b', 10));
+    batch.push_back(std::make_pair('h', 11));
+    batch.push_back(std::make_pair('h', 12));
+    batch.push_back(std::make_pair('b', 13));
+    BatchInsertResult added = bulk.insert_batch(batch.begin(), batch.end());
+    cout << "insert_batch: " << added.inserted << " inserted, "
+         << added.overwritten << " overwritten, b = " << bulk['b']
+         << ", h = " << bulk['h'] << endl;
+
+    // A small batch into a tree without subtree sizes, which only counts as
+    // much of itself as it takes to see that the batch is small
+    AVLTree<int,int> manyEvens;
+    fillMultiples(manyEvens, 2, 2000, 1);
+    std::vector<std::pair<int,int> > odds;
+    for(int i = 1; i < 40; i += 2) {
+        odds.push_back(std::make_pair(i, i));
+    }
+    BatchInsertResult oddsAdded = manyEvens.insert_batch(odds.begin(), odds.end());
+    cout << "insert_batch of 20 odd keys into 1000 evens: "
+         << oddsAdded.inserted << " inserted, size " << manyEvens.size() << ", "
+         << (manyEvens.isBalanced() ? "" : "not ") << "balanced" << endl;
+
+    // Range aggregates
+    AggregateAVLTree<int,int,SumAggregate<int> > sums;
+    for(int i = 1; i <= 10; i++) {
+        sums.insert(std::make_pair(i, i * i));
+    }
+    sums.remove(5);
+    cout << "Sum of squares from 3 to 7, skipping 5: " << sums.aggregate(3, 7)
+         << endl;
+    AggregateAVLTree<int,int,SumAggregate<int>,std::greater<int> > reversed;
+    for(int i = 1; i <= 10; i++) {
+        reversed.insert(std::make_pair(i, i * i));
+    }
+    cout << "Sum of squares from 7 down to 3, descending: "
+         << reversed.aggregate(7, 3) << endl;
+
+    // A subclass with its own node type has its nodes destroyed as that
+    // type, even by ~BinarySearchTree and from a pool
+    {
+        AggregateAVLTree<int,int,SumAggregate<Tally> > tallies;
+        tallies.setAllocator(std::make_shared<PoolNodeAllocator>());
+        for(int i = 1; i <= 100; i++) {
+            tallies.insert(std::make_pair(i, i));
+        }
+        cout << "Sum of 1 to 100 as Tallies: " << tallies.aggregate().n;
+    }
+    cout << ", " << Tally::live << " left alive after the tree is gone"
+         << endl;
+
+    // Building items in place
+    AVLTree<std::string,std::string> names;
+    names.try_emplace("pi", 4, '3');
+    names.try_emplace("pi", "ignored");
+    names.insert_or_assign("e", "2.718");
+    names.insert(std::make_pair(std::string("phi"), std::string("1.618")));
+    for(AVLTree<std::string,std::string>::iterator it = names.begin();
+        it != names.end(); ++it) {
+        cout << it->first << " = " << it->second << endl;
+    }
+
+    // Join and split
+    AVLTree<int,int> low, high, joined;
+    fillMultiples(low, 1, 5, 1);
+    fillMultiples(high, 10, 40, 1);
+    joined.join(low, std::make_pair(7, 7), high);
+    printItems("\njoin of 1-5, 7 and 10-40 by 10s", joined);
+    joined.split(10, low, high);
+    printItems("split at 10, left", low);
+    printItems("split at 10, right", high);
+
+    // Set operations on the multiples of 2 and of 3 up to 20. Where both
+    // have a key, union takes the second tree's value, which is 100 times
+    // the key.
+    AVLTree<int,int> evens, threes;
+    fillMultiples(evens, 2, 20, 1);
+    fillMultiples(threes, 3, 20, 100);
+    evens.union_with(threes);
+    printItems("union", evens);
+    evens.clear();
+    fillMultiples(evens, 2, 20, 1);
+    fillMultiples(threes, 3, 20, 100);
+    evens.intersection_with(threes);
+    printItems("intersection", evens);
+    evens.clear();
+    fillMultiples(evens, 2, 20, 1);
+    fillMultiples(threes, 3, 20, 100);
+    evens.difference_with(threes);
+    printItems("difference", evens);
+    cout << "The other tree is " << (threes.empty() ? "" : "not ")
+         << "left empty" << endl;
+
+    // The parallel set operations, with a grain small enough that they fork,
+    // give the same results as the serial ones
+    TaskPool pool(2);
+    const char* opNames[] = { "union", "intersection", "difference" };
+    for(int op = 0; op < 3; op++) {
+        AVLTree<int,int> serial, parallel, serialOther, parallelOther;
+        fillMultiples(serial, 2, 2000, 1);
+        fillMultiples(parallel, 2, 2000, 1);
+        fillMultiples(serialOther, 3, 2000, 100);
+        fillMultiples(parallelOther, 3, 2000, 100);
+        if(op == 0) {
+            serial.union_with(serialOther);
+            parallel.union_with(parallelOther, pool, 4);
+        }
+        else if(op == 1) {
+            serial.intersection_with(serialOther);
+            parallel.intersection_with(parallelOther, pool, 4);
+        }
+        else {
+            serial.difference_with(serialOther);
+            parallel.difference_with(parallelOther, pool, 4);
+        }
+        cout << "Parallel " << opNames[op] << ": " << parallel.size()
+             << " items, " << (sameItems(serial, parallel) ? "" : "NOT ")
+             << "the same as serial, " << (parallel.isBalanced() ? "" : "not ")
+             << "balanced" << endl;
+    }
+
+    // A sharded map read through find, operator[] and iteration while other
+    // threads insert and remove keys. The even keys are there throughout,
+    // and every key maps to itself.
+    ShardedAVLMap<int,int> shared(vector<int>{ 250, 500, 750 });
+    for(int k = 0; k < 1000; k += 2) {
+        shared.insert(std::make_pair(k, k));
+    }
+    int sharedErrors[4] = { 0, 0, 0, 0 };
+    vector<thread> sharedThreads;
+    for(int t = 0; t < 4; t++) {
+        sharedThreads.push_back(thread([&shared, &sharedErrors, t]() {
+            for(int round = 0; round < 20; round++) {
+                if(t < 2) {
+                    for(int k = 1 + 2 * t; k < 1000; k += 4) {
+                        shared.insert(std::make_pair(k, k));
+                    }
+                    for(int k = 1 + 2 * t; k < 1000; k += 4) {
+                        shared.remove(k);
+                    }
+                    continue;
+                }
+                for(int k = 0; k < 1000; k += 2) {
+                    ShardedAVLMap<int,int>::iterator it = shared.find(k);
+                    if(it == shared.end() || it->second != k ||
+                       shared[k] != k) {
+                        sharedErrors[t]++;
+                    }
+                }
+                int prev = -1, evens = 0;
+                for(ShardedAVLMap<int,int>::iterator it = shared.begin();
+                    it != shared.end(); ++it) {
+                    if(it->first <= prev || it->second != it->first) {
+                        sharedErrors[t]++;
+                    }
+                    evens += it->first % 2 == 0;
+                    prev = it->first;
+                }
+                if(evens != 500) {
+                    sharedErrors[t]++;
+                }
+            }
+        }));
+    }
+    for(size_t i = 0; i < sharedThreads.size(); i++) {
+        sharedThreads[i].join();
+    }
+    cout << "ShardedAVLMap read by 2 threads while 2 others write: "
+         << sharedErrors[2] + sharedErrors[3] << " errors, "
+         << shared.size() << " items left" << endl;
+
+    // Looking up keys in a hash-sharded map, where the shard after a key's
+    // own may hold smaller keys. Only the even keys are there.
+    ShardedAVLMap<int,int> hashed(4);
+    for(int k = 0; k < 40; k += 2) {
+        hashed.insert(std::make_pair(k, k));
+    }
+    int hashedWrong = 0;
+    for(int k = -5; k < 50; k++) {
+        ShardedAVLMap<int,int>::iterator it = hashed.find(k);
+        bool present = k >= 0 && k < 40 && k % 2 == 0;
+        int value;
+        if(present != (it != hashed.end()) ||
+           present != hashed.find(k, value) ||
+           (present && (it->first != k || value != k))) {
+            hashedWrong++;
+        }
+    }
+    cout << "Hash-sharded lookups of present and missing keys: "
+         << hashedWrong << " wrong" << endl;
+
+    // A tree read through find, contains, at and read() while other threads
+    // insert and remove keys. The even keys are there throughout, every key
+    // maps to itself, and each snapshot read() sees is balanced.
+    typedef ConcurrentAVLTree<int,int>::Tree ConcurrentCopy;
+    ConcurrentAVLTree<int,int> concurrent;
+    for(int k = 0; k < 1000; k += 2) {
+        concurrent.insert(std::make_pair(k, k));
+    }
+    int treeErrors[4] = { 0, 0, 0, 0 };
+    vector<thread> treeThreads;
+    for(int t = 0; t < 4; t++) {
+        treeThreads.push_back(thread([&concurrent, &treeErrors, t]() {
+            for(int round = 0; round < 20; round++) {
+                if(t < 2) {
+                    for(int k = 1 + 2 * t; k < 1000; k += 4) {
+                        concurrent.insert(std::make_pair(k, k));
+                    }
+                    for(int k = 1 + 2 * t; k < 1000; k += 4) {
+                        concurrent.remove(k);
+                    }
+                    continue;
+                }
+                for(int k = 0; k < 1000; k += 2) {
+                    int value = -1;
+                    if(!concurrent.find(k, value) || value != k ||
+                       !concurrent.contains(k) || concurrent.at(k) != k) {
+                        treeErrors[t]++;
+                    }
+                }
+                treeErrors[t] += concurrent.read(
+                    [](const ConcurrentCopy& tree) {
+                        int prev = -1, evens = 0, errors = 0;
+                        for(ConcurrentCopy::iterator it = tree.begin();
+                            it != tree.end(); ++it) {
+                            if(it->first <= prev || it->second != it->first) {
+                                errors++;
+                            }
+                            evens += it->first % 2 == 0;
+                            prev = it->first;
+                        }
+                        return errors + (evens != 500) + !tree.isBalanced();
+                    });
+            }
+        }));
+    }
+    for(size_t i = 0; i < treeThreads.size(); i++) {
+        treeThreads[i].join();
+    }
+    cout << "ConcurrentAVLTree read by 2 threads while 2 others write: "
+         << treeErrors[2] + treeErrors[3] << " errors, "
+         << concurrent.size() << " items left" << endl;
+
+    // A write that fails on the second copy, after the first is published,
+    // still leaves both copies with the change. The empty write after it
+    // publishes the copy it failed on.
+    int writeCalls = 0;
+    concurrent.write([&writeCalls](ConcurrentCopy& tree) {
+        if(++writeCalls == 2) {
+            throw std::bad_alloc();
+        }
+        tree.insert(std::make_pair(1001, 1001));
+    });
+    bool firstHasIt = concurrent.contains(1001);
+    concurrent.write([](ConcurrentCopy&) {});
+    cout << "A write failing on the second copy is "
+         << (firstHasIt ? "" : "not ") << "in the first and "
+         << (concurrent.contains(1001) ? "" : "not ") << "in the second, "
+         << "which holds " << concurrent.size() << " items" << endl;
+
+    // Read-only layouts of the multiples of 3 up to 1000
+    AVLTree<int,int> threesUpTo1000;
+    fillMultiples(threesUpTo1000, 3, 1000, 1);
+
+    // Frozen snapshot in Eytzinger order
+    FrozenTree<int,int> frozen = freeze(threesUpTo1000);
+    int frozenFound = 0, frozenWrong = 0, frozenPrev = -1;
+    bool frozenOrdered = true;
+    for(int k = 0; k <= 1001; k++) {
+        FrozenTree<int,int>::iterator it = frozen.find(k);
+        if(it != frozen.end() && it->second == k) {
+            frozenFound++;
+        }
+        else if((it == frozen.end()) != (k % 3 != 0 || k == 0)) {
+            frozenWrong++;
+        }
+    }
+    for(FrozenTree<int,int>::iterator it = frozen.begin(); it != frozen.end();
+        ++it) {
+        frozenOrdered = frozenOrdered && it->first > frozenPrev;
+        frozenPrev = it->first;
+    }
+    cout << "FrozenTree: " << frozen.size() << " items, " << frozenFound
+         << " found, " << frozenWrong << " wrong, "
+         << (frozenOrdered ? "" : "not ") << "in order, lower_bound(100): "
+         << frozen.lower_bound(100)->first << endl;
+
+    // Batched lookups, which must agree with find key by key
+    vector<int> batchKeys;
+    for(int k = 1001; k >= 0; k -= 7) {
+        batchKeys.push_back(k);
+    }
+    vector<AVLTree<int,int>::iterator> batchFound;
+    threesUpTo1000.find_batch(batchKeys.begin(), batchKeys.end(),
+                              std::back_inserter(batchFound));
+    int batchHits = 0, batchWrong = 0;
+    for(size_t i = 0; i < batchKeys.size(); i++) {
+        if(batchFound[i] != threesUpTo1000.find(batchKeys[i])) {
+            batchWrong++;
+        }
+        else if(batchFound[i] != threesUpTo1000.end()) {
+            batchHits++;
+        }
+    }
+    cout << "find_batch: " << batchKeys.size() << " keys, " << batchHits
+         << " found, " << batchWrong << " different from find" << endl;
+
+    // van Emde Boas layout, with updates going to the overflow tree until it
+    // is compacted again
+    VebTree<int,int> veb(threesUpTo1000);
+    map<int,int> vebExpected;
+    for(int k = 3; k <= 1000; k += 3) {
+        vebExpected[k] = k;
+    }
+    bool vebSame = sameAsMap(veb, vebExpected);
+    for(int k = 1; k <= 60; k++) {
+        if(k % 3 == 0) {
+            veb.remove(k);
+            vebExpected.erase(k);
+        }
+        else {
+            veb.insert(std::make_pair(k, -k));
+            vebExpected[k] = -k;
+        }
+    }
+    cout << "VebTree: " << veb.size() << " items, "
+         << veb.overflow_size() << " in the overflow tree, ";
+    vebSame = vebSame && sameAsMap(veb, vebExpected);
+    veb.compact();
+    vebSame = vebSame && sameAsMap(veb, vebExpected);
+    cout << (vebSame ? "" : "NOT ") << "the same as std::map before and "
+         << "after compact()" << endl;
+
+    // Static B+ tree, which needs three layers of nodes for these
+    StaticBTree<int,int> btree(threesUpTo1000);
+    int btreeFound = 0, btreeWrong = 0;
+    for(int k = 0; k <= 1001; k++) {
+        StaticBTree<int,int>::iterator it = btree.find(k);
+        if(it != btree.end() && it->second == k) {
+            btreeFound++;
+        }
+        else if((it == btree.end()) != (k % 3 != 0 || k == 0)) {
+            btreeWrong++;
+        }
+    }
+    cout << "StaticBTree: " << btree.size() << " items, " << btreeFound
+         << " found, " << btreeWrong << " wrong, lower_bound(100): "
+         << btree.lower_bound(100)->first << ", lower_bound(1000) is "
+         << (btree.lower_bound(1000) == btree.end() ? "" : "not ") << "end()"
+         << endl;
+
+    // Float keys, where the padding has to be +infinity for searches for
+    // the largest keys to stay inside the layers
+    vector<std::pair<float,int> > floatItems;
+    for(int i = 0; i < 20; i++) {
+        floatItems.push_back(std::make_pair(i * 0.5f, i));
+    }
+    StaticBTree<float,int> fbtree(floatItems.begin(), floatItems.end());
+    floatItems.push_back(std::make_pair(INFINITY, 20));
+    StaticBTree<float,int> infbtree(floatItems.begin(), floatItems.end());
+    cout << "StaticBTree<float>: find(9.5): " << fbtree.find(9.5f)->second
+         << ", find(inf) is "
+         << (fbtree.find(INFINITY) == fbtree.end() ? "" : "not ") << "end()"
+         << ", find(-inf) is "
+         << (fbtree.find(-INFINITY) == fbtree.end() ? "" : "not ") << "end()"
+         << ", with inf stored: find(inf): " << infbtree.find(INFINITY)->second
+         << ", find(9.5): " << infbtree.find(9.5f)->second << endl;
+
+    // AVL tree with 32-bit links in one array, in insertion orders that
+    // need every kind of rotation, then removals that need more
+    CompactAVLTree<int,int> compact;
+    map<int,int> compactExpected;
+    for(int i = 0; i < 300; i++) {
+        int k = (i * 37) % 300;
+        compact.insert(std::make_pair(k, 2 * k));
+        compactExpected[k] = 2 * k;
+    }
+    bool compactBalanced = compact.isBalanced();
+    for(int k = 0; k < 300; k += 2) {
+        compact.remove(k);
+        compactExpected.erase(k);
+        compactBalanced = compactBalanced && compact.isBalanced();
+    }
+    compact.remove(1000);
+    cout << "CompactAVLTree: " << compact.size() << " items, "
+         << (compactBalanced ? "" : "not ") << "balanced throughout, "
+         << (sameAsMap(compact, compactExpected) ? "" : "NOT ")
+         << "the same as std::map" << endl;
+
+    // Custom and transparent comparators
+    AVLTree<int,int,std::greater<int> > descending;
+    for(int i = 1; i <= 5; i++) {
+        descending.insert(std::make_pair(i, i));
+    }
+    cout << "Descending:";
+    for(AVLTree<int,int,std::greater<int> >::iterator it = descending.begin();
+        it != descending.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+    AVLTree<std::string,int,std::less<> > words;
+    words.insert(std::make_pair(std::string("apple"), 1));
+    words.insert(std::make_pair(std::string("pear"), 2));
+    cout << "Found pear without a std::string: "
+         << words.find("pear")->second << ", lower_bound(b): "
+         << words.lower_bound(std::string_view("b"))->first << endl;
+
+    // Hinted insertion and finger search
+    AVLTree<int,int> log;
+    AVLTree<int,int>::iterator last = log.end();
+    for(int t = 10; t <= 100; t += 10) {
+        last = log.insert(last, std::make_pair(t, t / 10));
+    }
+    last = log.insert(last, std::make_pair(95, 0));
+    cout << "Found 90 from 95: " << log.find_from(last, 90)->second << endl;
+
+    // Red-black tree
+    RBTree<int,int> rb;
+    for(int i = 1; i <= 7; i++) {
+        rb.insert(std::make_pair(i, i));
+    }
+    rb.remove(4);
+    cout << "\nRBTree after removing 4:" << endl;
+    rb.print();
+
+    // Ascending inserts leave red-black trees lopsided by AVL standards, but
+    // they still keep the red-black rules throughout
+    RBTree<int,int> rbBig;
+    bool rbBalanced = true;
+    for(int i = 1; i <= 1000; i++) {
+        rbBig.insert(std::make_pair(i, i));
+        rbBalanced = rbBalanced && rbBig.isBalanced();
+    }
+    for(int i = 1; i <= 1000; i += 3) {
+        rbBig.remove(i);
+        rbBalanced = rbBalanced && rbBig.isBalanced();
+    }
+    cout << "RBTree of 1 to 1000, every third removed: " << rbBig.size()
+         << " items, " << (rbBalanced ? "" : "not ")
+         << "balanced throughout" << endl;
+
+    // Splay tree: a lookup brings the key to the root
+    SplayTree<int,int> st;
+    for(int i = 1; i <= 7; i++) {
+        st.insert(std::make_pair(i, i));
+    }
+    st.find(3);
+    cout << "\nSplayTree after finding 3:" << endl;
+    st.print();
+
+    // Scapegoat tree: ascending inserts get rebuilt rather than a long chain
+    ScapegoatTree<int,int> sg;
+    for(int i = 1; i <= 10; i++) {
+        sg.insert(std::make_pair(i, i));
+    }
+    cout << "\nScapegoatTree after inserting 1 to 10:" << endl;
+    sg.print();
+
+    // Removals from a scapegoat tree built all at once, leaving just its
+    // leftmost path unless they trigger a rebuild
+    MeasuredTree<ScapegoatTree<int,int> > sgBuilt;
+    vector<std::pair<int,int> > sgItems;
+    for(int i = 1; i <= 1023; i++) {
+        sgItems.push_back(std::make_pair(i, i));
+    }
+    sgBuilt.build_from_sorted(sgItems.begin(), sgItems.end());
+    for(int i = 1; i <= 1023; i++) {
+        if((i & (i - 1)) != 0) {
+            sgBuilt.remove(i);
+        }
+    }
+    cout << "\nScapegoatTree built from 1 to 1023, then all but the powers of "
+         << "two removed: " << sgBuilt.size() << " items, height "
+         << sgBuilt.height() << endl;
+
+    // Sorted inserts into a plain tree with a loose height bound, which
+    // lets chains grow far taller than 64 before they get rebalanced
+    MeasuredTree<BinarySearchTree<int,int,std::less<int>,true> > loose;
+    loose.setAutoRebalance(5);
+    for(int i = 1; i <= 20000; i++) {
+        loose.insert(std::make_pair(i, i));
+    }
+    double looseBound = 5 * std::log2(loose.size() + 1.0);
+    cout << "BST of 1 to 20000 with auto-rebalance factor 5: height "
+         << loose.height() << (loose.height() <= looseBound ? ", " : ", NOT ")
+         << "within " << looseBound << endl;
+
+    // A chain from sorted inserts, rebalanced in place
+    BinarySearchTree<int,int> chain;
+    for(int i = 1; i <= 7; i++) {
+        chain.insert(std::make_pair(i, i));
+    }
+    chain.rebalance();
+    cout << "\nBST of 1 to 7 after rebalance:" << endl;
+    chain.print();
+
     return 0;
 }
@@ -1,22 +1,58 @@
 #ifndef BST_H
 #define BST_H
 
+#include "node_alloc.h"
+#include "node_writes.h"
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <exception>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+/**
+ * Supplies the item for an insertion. The tree searches for key(), then
+ * either calls found() with the value already stored there, or make() to
+ * build the item of the new node. make() returns by value so that the item
+ * is constructed straight into the node, with no temporary in between.
+ */
+template <typename Key, typename Value> class ItemMaker {
+  public:
+    virtual ~ItemMaker() {}
+    virtual const Key& key() const = 0;
+    virtual std::pair<const Key, Value> make() = 0;
+    virtual void found(Value& value) = 0;
+};
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The getters for parent/left/right are not virtual, so
+ * that every hop through the tree can be inlined and
+ * nodes don't carry a vtable pointer. Node types for
+ * other kinds of search trees, such as AVL trees, hide
+ * them with versions that return their own node type, and
+ * the tree that owns a node is responsible for destroying
+ * it as the right type (see use_nodes).
  */
 template <typename Key, typename Value> class Node {
   public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    Node(ItemMaker<Key, Value>& maker, Node<Key, Value>* parent);
+    // Does nothing, since the nodes pointed to by parent/left/right are freed
+    // by the BinarySearchTree. Defaulted here so that it stays trivial for
+    // trivial items, which lets clear() skip visiting the nodes.
+    ~Node() = default;
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -24,9 +60,9 @@ template <typename Key, typename Value> class Node {
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
@@ -55,11 +91,11 @@ Node<Key, Value>::Node(const Key& key, const Value& value,
     : item_(key, value), parent_(parent), left_(NULL), right_(NULL) {}
 
 /**
- * Destructor, which does not need to do anything since the pointers inside of a
- * node are only used as references to existing nodes. The nodes pointed to by
- * parent/left/right are freed by the BinarySearchTree.
+ * Constructs a node whose item is built in place by maker.
  */
-template <typename Key, typename Value> Node<Key, Value>::~Node() {}
+template <typename Key, typename Value>
+Node<Key, Value>::Node(ItemMaker<Key, Value>& maker, Node<Key, Value>* parent)
+    : item_(maker.make()), parent_(parent), left_(NULL), right_(NULL) {}
 
 /**
  * A const getter for the item.
@@ -101,7 +137,7 @@ template <typename Key, typename Value> Value& Node<Key, Value>::getValue() {
 }
 
 /**
- * An implementation of the virtual function for retreiving the parent.
+ * A getter for the parent.
  */
 template <typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const {
@@ -109,7 +145,7 @@ Node<Key, Value>* Node<Key, Value>::getParent() const {
 }
 
 /**
- * An implementation of the virtual function for retreiving the left child.
+ * A getter for the left child.
  */
 template <typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const {
@@ -117,7 +153,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const {
 }
 
 /**
- * An implementation of the virtual function for retreiving the right child.
+ * A getter for the right child.
  */
 template <typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const {
@@ -129,6 +165,7 @@ Node<Key, Value>* Node<Key, Value>::getRight() const {
  */
 template <typename Key, typename Value>
 void Node<Key, Value>::setParent(Node<Key, Value>* parent) {
+    BST_NOTE_WRITE(FIELD_PARENT);
     parent_ = parent;
 }
 
@@ -137,6 +174,7 @@ void Node<Key, Value>::setParent(Node<Key, Value>* parent) {
  */
 template <typename Key, typename Value>
 void Node<Key, Value>::setLeft(Node<Key, Value>* left) {
+    BST_NOTE_WRITE(FIELD_CHILD);
     left_ = left;
 }
 
@@ -145,6 +183,7 @@ void Node<Key, Value>::setLeft(Node<Key, Value>* left) {
  */
 template <typename Key, typename Value>
 void Node<Key, Value>::setRight(Node<Key, Value>* right) {
+    BST_NOTE_WRITE(FIELD_CHILD);
     right_ = right;
 }
 
@@ -163,18 +202,217 @@ void Node<Key, Value>::setValue(const Value& value) {
 */
 
 /**
- * A templated unbalanced binary search tree.
+ * A Node that also counts the nodes in its subtree, for the trees that keep
+ * subtree sizes (see BinarySearchTree's Sized). It has the same getters as
+ * Node, so a tree's code reads the same whichever of the two it uses.
+ */
+template <typename Key, typename Value>
+class SizedNode : public Node<Key, Value> {
+  public:
+    SizedNode(const Key& key, const Value& value, Node<Key, Value>* parent);
+    SizedNode(ItemMaker<Key, Value>& maker, Node<Key, Value>* parent);
+
+    std::size_t getSize() const;
+    void setSize(std::size_t size);
+
+  protected:
+    std::size_t size_; // number of nodes in the subtree rooted here
+};
+
+template <typename Key, typename Value>
+SizedNode<Key, Value>::SizedNode(const Key& key, const Value& value,
+                                 Node<Key, Value>* parent)
+    : Node<Key, Value>(key, value, parent), size_(1) {}
+
+template <typename Key, typename Value>
+SizedNode<Key, Value>::SizedNode(ItemMaker<Key, Value>& maker,
+                                 Node<Key, Value>* parent)
+    : Node<Key, Value>(maker, parent), size_(1) {}
+
+/**
+ * A getter for the number of nodes in this node's subtree, itself included.
+ */
+template <typename Key, typename Value>
+std::size_t SizedNode<Key, Value>::getSize() const {
+    return size_;
+}
+
+/**
+ * A setter for the size of a node's subtree. The tree keeps it up to date.
+ */
+template <typename Key, typename Value>
+void SizedNode<Key, Value>::setSize(std::size_t size) {
+    BST_NOTE_WRITE(FIELD_SIZE);
+    size_ = size;
+}
+
+/**
+ * The node type a tree's own node type builds on: SizedNode for a tree that
+ * keeps subtree sizes, else Node.
+ */
+template <typename Key, typename Value, bool Sized>
+using BaseNode = typename std::conditional<Sized, SizedNode<Key, Value>,
+                                           Node<Key, Value> >::type;
+
+/*
+ * The ItemMakers behind the insert family. Each holds references to the
+ * caller's arguments, which only live as long as the call.
+ */
+
+// Copies a key and value into the tree, overwriting on a match
+template <typename Key, typename Value>
+class CopiedItem : public ItemMaker<Key, Value> {
+  public:
+    CopiedItem(const Key& key, const Value& value)
+        : key_(key), value_(value) {}
+    const Key& key() const { return key_; }
+    std::pair<const Key, Value> make() {
+        return std::pair<const Key, Value>(key_, value_);
+    }
+    void found(Value& value) { value = value_; }
+
+  private:
+    const Key& key_;
+    const Value& value_;
+};
+
+// Moves (or copies, for an lvalue) a whole pair into the tree, overwriting on
+// a match. Pair is std::pair<Key, Value> with any reference qualifiers.
+template <typename Key, typename Value, typename Pair>
+class ForwardedItem : public ItemMaker<Key, Value> {
+  public:
+    explicit ForwardedItem(Pair&& item) : item_(item) {}
+    const Key& key() const { return item_.first; }
+    std::pair<const Key, Value> make() {
+        return std::pair<const Key, Value>(std::forward<Pair>(item_));
+    }
+    void found(Value& value) { value = std::forward<Pair>(item_).second; }
+
+  private:
+    Pair& item_;
+};
+
+// Builds the value from args for a key that isn't there yet, and leaves an
+// existing value alone
+template <typename Key, typename Value, typename K, typename... Args>
+class EmplacedItem : public ItemMaker<Key, Value> {
+  public:
+    EmplacedItem(K&& key, Args&&... args)
+        : key_(key), args_(std::forward<Args>(args)...) {}
+    const Key& key() const { return key_; }
+    std::pair<const Key, Value> make() {
+        return std::pair<const Key, Value>(
+            std::piecewise_construct,
+            std::forward_as_tuple(std::forward<K>(key_)), std::move(args_));
+    }
+    void found(Value& value) {}
+
+  private:
+    K& key_;
+    std::tuple<Args&&...> args_;
+};
+
+// Builds the value from obj for a new key, or assigns obj to an existing one
+template <typename Key, typename Value, typename K, typename M>
+class AssignedItem : public ItemMaker<Key, Value> {
+  public:
+    AssignedItem(K&& key, M&& obj) : key_(key), obj_(obj) {}
+    const Key& key() const { return key_; }
+    std::pair<const Key, Value> make() {
+        return std::pair<const Key, Value>(std::forward<K>(key_),
+                                           std::forward<M>(obj_));
+    }
+    void found(Value& value) { value = std::forward<M>(obj_); }
+
+  private:
+    K& key_;
+    M& obj_;
+};
+
+/*
+ * How the trees' searches compare a key with the keys in the nodes.
+ * KeyOrder<Compare, A, B>::order(comp, a, b) is negative, zero or positive as
+ * a sorts before, together with, or after b, in one comparison: numbers
+ * compare directly, and std::string or std::string_view keys with a single
+ * pass over the characters. A search with such an order stops at the node
+ * that holds its key.
+ *
+ * That only works for std::less, where the order is known. For any other
+ * Compare, exact is false and searches instead call comp once per level to
+ * pick a side, checking for equality only once at the bottom.
+ */
+template <typename Compare> struct is_plain_less : std::false_type {};
+template <typename T> struct is_plain_less<std::less<T> > : std::true_type {};
+
+template <typename Compare, typename A, typename B, typename = void>
+struct KeyOrder {
+    static const bool exact = false;
+};
+
+template <typename Compare, typename A, typename B>
+struct KeyOrder<Compare, A, B,
+                typename std::enable_if<is_plain_less<Compare>::value &&
+                                        std::is_arithmetic<A>::value &&
+                                        std::is_arithmetic<B>::value>::type> {
+    static const bool exact = true;
+    static int order(const Compare&, const A& a, const B& b) {
+        return (b < a) - (a < b);
+    }
+};
+
+template <typename Compare, typename A, typename B>
+struct KeyOrder<
+    Compare, A, B,
+    typename std::enable_if<
+        is_plain_less<Compare>::value &&
+        std::is_convertible<const A&, std::string_view>::value &&
+        (std::is_same<B, std::string>::value ||
+         std::is_same<B, std::string_view>::value)>::type> {
+    static const bool exact = true;
+    static int order(const Compare&, const A& a, const B& b) {
+        return std::string_view(a).compare(std::string_view(b));
+    }
+};
+
+/**
+ * A templated unbalanced binary search tree, ordered by Compare. With a
+ * transparent Compare such as std::less<>, find, lower_bound, upper_bound and
+ * equal_range also take any type that Compare can compare with Key, e.g. a
+ * const char* or std::string_view for std::string keys, without converting
+ * it to a Key first.
+ *
+ * With Sized, every node also stores the size of its subtree, which makes
+ * size() O(1) and is what rank, select and setAutoRebalance work from. It
+ * costs a word per node and a store at every level of each insert and
+ * remove, so it is off by default; size() then counts the nodes.
  */
-template <typename Key, typename Value> class BinarySearchTree {
+template <typename Key, typename Value, typename Compare = std::less<Key>,
+          bool Sized = false>
+class BinarySearchTree {
   public:
     BinarySearchTree();
+    explicit BinarySearchTree(const Compare& comp);
     virtual ~BinarySearchTree();
     virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+    template <typename Pair,
+              typename = typename std::enable_if<std::is_same<
+                  typename std::decay<Pair>::type,
+                  std::pair<Key, Value> >::value>::type>
+    void insert(Pair&& keyValuePair);
     virtual void remove(const Key& key);
     void clear();
-    bool isBalanced() const;
+    template <typename ForwardIt>
+    void build_from_sorted(ForwardIt first, ForwardIt last);
+    virtual bool isBalanced() const;
+    void rebalance();
+    void setAutoRebalance(double factor);
     void print() const;
     bool empty() const;
+    std::size_t size() const;
+    std::size_t rank(const Key& key) const;
+    Compare key_comp() const;
+    std::shared_ptr<NodeAllocator> getAllocator() const;
+    void setAllocator(std::shared_ptr<NodeAllocator> alloc);
 
     template <typename PPKey, typename PPValue>
     friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue>& tree);
@@ -196,7 +434,7 @@ template <typename Key, typename Value> class BinarySearchTree {
         iterator& operator++();
 
       protected:
-        friend class BinarySearchTree<Key, Value>;
+        friend class BinarySearchTree<Key, Value, Compare, Sized>;
         iterator(Node<Key, Value>* ptr);
         Node<Key, Value>* current_;
     };
@@ -205,14 +443,99 @@ template <typename Key, typename Value> class BinarySearchTree {
     iterator begin() const;
     iterator end() const;
     iterator find(const Key& key) const;
+    template <typename K, typename C = Compare,
+              typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    iterator find_from(iterator hint, const Key& key) const;
+    template <typename ForwardIt, typename OutputIt>
+    OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out) const;
     Value& operator[](const Key& key);
     Value const& operator[](const Key& key) const;
 
+    /**
+     * The items with keys in some range, as a pair of iterators that can be
+     * used in a range-based for loop.
+     */
+    class range_view {
+      public:
+        range_view(iterator first, iterator last);
+        iterator begin() const;
+        iterator end() const;
+        bool empty() const;
+
+      private:
+        iterator first_;
+        iterator last_;
+    };
+
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    template <typename K, typename C = Compare,
+              typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    template <typename K, typename C = Compare,
+              typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const;
+    template <typename K, typename C = Compare,
+              typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K& key) const;
+    range_view range(const Key& lo, const Key& hi) const;
+    iterator select(std::size_t k) const;
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+    iterator insert(iterator hint,
+                    const std::pair<const Key, Value>& keyValuePair);
+    template <typename Pair,
+              typename = typename std::enable_if<std::is_same<
+                  typename std::decay<Pair>::type,
+                  std::pair<Key, Value> >::value>::type>
+    iterator insert(iterator hint, Pair&& keyValuePair);
+
   protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const;
+    // The lookups take anything Compare can compare with a Key, and make one
+    // comparison per level (see KeyOrder).
+    template <typename K> Node<Key, Value>* internalFind(const K& k) const;
+    template <typename K>
+    Node<Key, Value>* find_slot(const K& key, Node<Key, Value>* node,
+                                Node<Key, Value>*& parent, bool& left) const;
     Node<Key, Value>* getSmallestNode() const;
+    // Finger search. climb returns the lowest node at or above node whose
+    // subtree covers key, or the node holding key if it passes that on the
+    // way up. insert_start picks where an insert begins: near hint, else
+    // beside the node last inserted if key belongs there, else the root.
+    template <typename K>
+    Node<Key, Value>* climb(Node<Key, Value>* node, const K& key) const;
+    template <typename K>
+    Node<Key, Value>* insert_start(const K& key, Node<Key, Value>* hint) const;
+    Node<Key, Value>* hint_node(iterator hint) const;
+    // Lets subclasses hand out iterators to the nodes they find
+    static iterator node_iterator(Node<Key, Value>* node);
+    template <typename K>
+    Node<Key, Value>* lower_bound_node(const K& key) const;
+    template <typename K>
+    Node<Key, Value>* upper_bound_node(const K& key) const;
     static Node<Key, Value>* predecessor(Node<Key, Value>* current);
+    // Subtree sizes. Only Sized trees may call subtree_size; for the others
+    // update_sizes and recount do nothing, so code shared by both kinds can
+    // call them unconditionally. recount sets node's size from its
+    // children's, e.g. after a rotation.
+    static std::size_t subtree_size(Node<Key, Value>* node);
+    static void update_sizes(Node<Key, Value>* node, std::size_t added,
+                             std::size_t removed);
+    static void recount(Node<Key, Value>* node);
+    std::size_t count_nodes(std::size_t limit) const;
+    static int min_height(std::size_t size);
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
@@ -221,18 +544,73 @@ template <typename Key, typename Value> class BinarySearchTree {
     virtual void nodeSwap(Node<Key, Value>* n1, Node<Key, Value>* n2);
 
     // Add helper functions here
+    // Subclasses with their own kind of node call use_nodes<NodeType>() in
+    // their constructors. create_node and destroy_node then make and free
+    // nodes of that type through the functions it records rather than
+    // through virtual calls, so ~BinarySearchTree can still free them after
+    // the subclass's part of the tree is gone, and subclasses don't need
+    // destructors of their own.
+    template <typename NodeType> void use_nodes();
+    Node<Key, Value>* create_node(ItemMaker<Key, Value>& maker,
+                                  Node<Key, Value>* parent);
+    void destroy_node(Node<Key, Value>* node);
+    void clear_helper(Node<Key, Value>* node);
+    // Every insertion ends up here. hint is a node near where maker's key
+    // goes, or NULL. Returns the node holding the key afterwards, and whether
+    // it is new.
+    virtual Node<Key, Value>* insert_item(ItemMaker<Key, Value>& maker,
+                                          Node<Key, Value>* hint,
+                                          bool& inserted);
+    // Called on each node made by build_from_sorted or relinked by rebalance
+    // once both of its subtrees are complete, so subclasses can fill in their
+    // balance information. The subtrees hold leftSize and rightSize nodes
+    // and are of minimum height, min_height of their size.
+    virtual void build_fix(Node<Key, Value>* node, std::size_t leftSize,
+                           std::size_t rightSize);
+    template <typename ForwardIt>
+    Node<Key, Value>* build_helper(ForwardIt& first, std::size_t n,
+                                   Node<Key, Value>* parent);
+    // Relinks the subtree at top, which may be NULL, into one of minimum
+    // height in place, as rebalance does the whole tree. For trees that
+    // rebuild parts of themselves, such as ScapegoatTree.
+    void rebuild_subtree(Node<Key, Value>* top);
+
   private:
-    static void insert_helper(const std::pair<const Key, Value>& keyValuePair,
-                              Node<Key, Value>* node);
-    static Node<Key, Value>* internalFind_helper(const Key& key,
-                                                 Node<Key, Value>* node);
-    static void clear_helper(Node<Key, Value>* node);
+    // How many searches find_batch runs at once. About as many cache misses
+    // as a core can have in flight; more made no measurable difference.
+    static const std::size_t find_batch_group = 16;
+    Node<Key, Value>* insert_helper(ItemMaker<Key, Value>& maker,
+                                    Node<Key, Value>* node, bool& inserted);
     static int isBalanced_helper(Node<Key, Value>* node);
     static Node<Key, Value>* successor(Node<Key, Value>* current);
+    void auto_rebalance(Node<Key, Value>* node);
+    Node<Key, Value>* tree_to_vine(Node<Key, Value>* above,
+                                   Node<Key, Value>* top, std::size_t& n);
+    Node<Key, Value>* compress(Node<Key, Value>* above, Node<Key, Value>* top,
+                               std::size_t count);
+    void replace_child(Node<Key, Value>* parent, Node<Key, Value>* from_node,
+                       Node<Key, Value>* to_node);
+    void rebalance_fix(Node<Key, Value>* top);
+    template <typename NodeType>
+    static Node<Key, Value>* make_node(NodeAllocator& alloc,
+                                       ItemMaker<Key, Value>& maker,
+                                       Node<Key, Value>* parent);
+    template <typename NodeType>
+    static void unmake_node(Node<Key, Value>* node);
+
+    // Set by use_nodes
+    Node<Key, Value>* (*makeNode_)(NodeAllocator& alloc,
+                                   ItemMaker<Key, Value>& maker,
+                                   Node<Key, Value>* parent);
+    void (*unmakeNode_)(Node<Key, Value>* node); // runs the destructor
+    bool trivialNodes_; // whether the destructor can be skipped
 
   protected:
     Node<Key, Value>* root_;
-    // You should not need other data members
+    std::shared_ptr<NodeAllocator> alloc_;
+    Compare comp_;
+    Node<Key, Value>* finger_; // the node last inserted, or NULL
+    double rebalanceFactor_;   // see setAutoRebalance; 0 is off
 };
 
 /*
@@ -244,34 +622,35 @@ Begin implementations for the BinarySearchTree::iterator class.
 /**
  * Explicit constructor that initializes an iterator with a given node pointer.
  */
-template <class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key, Value>* ptr) {
+template <class Key, class Value, class Compare, bool Sized>
+BinarySearchTree<Key, Value, Compare, Sized>::iterator::iterator(
+    Node<Key, Value>* ptr) {
     current_ = ptr;
 }
 
 /**
  * A default constructor that initializes the iterator to NULL.
  */
-template <class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() {
+template <class Key, class Value, class Compare, bool Sized>
+BinarySearchTree<Key, Value, Compare, Sized>::iterator::iterator() {
     current_ = nullptr;
 }
 
 /**
  * Provides access to the item.
  */
-template <class Key, class Value>
+template <class Key, class Value, class Compare, bool Sized>
 std::pair<const Key, Value>&
-BinarySearchTree<Key, Value>::iterator::operator*() const {
+BinarySearchTree<Key, Value, Compare, Sized>::iterator::operator*() const {
     return current_->getItem();
 }
 
 /**
  * Provides access to the address of the item.
  */
-template <class Key, class Value>
+template <class Key, class Value, class Compare, bool Sized>
 std::pair<const Key, Value>*
-BinarySearchTree<Key, Value>::iterator::operator->() const {
+BinarySearchTree<Key, Value, Compare, Sized>::iterator::operator->() const {
     return &(current_->getItem());
 }
 
@@ -279,9 +658,9 @@ BinarySearchTree<Key, Value>::iterator::operator->() const {
  * Checks if 'this' iterator's internals have the same value
  * as 'rhs'
  */
-template <class Key, class Value>
-bool BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const {
+template <class Key, class Value, class Compare, bool Sized>
+bool BinarySearchTree<Key, Value, Compare, Sized>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare, Sized>::iterator& rhs) const {
     return current_ == rhs.current_;
 }
 
@@ -289,18 +668,18 @@ bool BinarySearchTree<Key, Value>::iterator::operator==(
  * Checks if 'this' iterator's internals have a different value
  * as 'rhs'
  */
-template <class Key, class Value>
-bool BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const {
+template <class Key, class Value, class Compare, bool Sized>
+bool BinarySearchTree<Key, Value, Compare, Sized>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare, Sized>::iterator& rhs) const {
     return current_ != rhs.current_;
 }
 
 /**
  * Advances the iterator's location using an in-order sequencing
  */
-template <class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++() {
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator&
+BinarySearchTree<Key, Value, Compare, Sized>::iterator::operator++() {
     current_ = successor(current_);
     return *this;
 }
@@ -311,6 +690,31 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/**
+ * Constructs a view of the items in [first, last).
+ */
+template <class Key, class Value, class Compare, bool Sized>
+BinarySearchTree<Key, Value, Compare, Sized>::range_view::range_view(
+    iterator first, iterator last)
+    : first_(first), last_(last) {}
+
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::range_view::begin() const {
+    return first_;
+}
+
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::range_view::end() const {
+    return last_;
+}
+
+template <class Key, class Value, class Compare, bool Sized>
+bool BinarySearchTree<Key, Value, Compare, Sized>::range_view::empty() const {
+    return first_ == last_;
+}
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -320,26 +724,133 @@ Begin implementations for the BinarySearchTree class.
 /**
  * Default constructor for a BinarySearchTree, which sets the root to NULL.
  */
-template <class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() {
+template <class Key, class Value, class Compare, bool Sized>
+BinarySearchTree<Key, Value, Compare, Sized>::BinarySearchTree()
+    : alloc_(HeapNodeAllocator::instance()), finger_(nullptr),
+      rebalanceFactor_(0) {
     root_ = nullptr;
+    use_nodes<BaseNode<Key, Value, Sized> >();
 }
 
-template <typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree() {
+/**
+ * Constructs an empty tree ordered by a copy of comp.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+BinarySearchTree<Key, Value, Compare, Sized>::BinarySearchTree(
+    const Compare& comp)
+    : alloc_(HeapNodeAllocator::instance()), comp_(comp), finger_(nullptr),
+      rebalanceFactor_(0) {
+    root_ = nullptr;
+    use_nodes<BaseNode<Key, Value, Sized> >();
+}
+
+/**
+ * Frees the nodes as whatever type use_nodes last chose, so subclasses don't
+ * have to clear the tree themselves.
+ */
+template <typename Key, typename Value, typename Compare, bool Sized>
+BinarySearchTree<Key, Value, Compare, Sized>::~BinarySearchTree() {
     clear();
 }
 
 /**
  * Returns true if tree is empty
  */
-template <class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const {
+template <class Key, class Value, class Compare, bool Sized>
+bool BinarySearchTree<Key, Value, Compare, Sized>::empty() const {
     return root_ == NULL;
 }
 
-template <typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const {
+/**
+ * Returns a copy of the comparison object that orders the keys.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+Compare BinarySearchTree<Key, Value, Compare, Sized>::key_comp() const {
+    return comp_;
+}
+
+/**
+ * Returns the allocator this tree's nodes come from.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+std::shared_ptr<NodeAllocator>
+BinarySearchTree<Key, Value, Compare, Sized>::getAllocator() const {
+    return alloc_;
+}
+
+/**
+ * Switches the tree to a different node allocator, e.g. a PoolNodeAllocator.
+ * Only allowed while the tree is empty, since existing nodes have to be
+ * returned to the allocator they came from.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::setAllocator(
+    std::shared_ptr<NodeAllocator> alloc) {
+    if (root_ != nullptr) {
+        throw std::logic_error("Can't change the allocator of a non-empty tree");
+    }
+    alloc_ = alloc ? alloc : HeapNodeAllocator::instance();
+}
+
+/**
+ * Returns the number of items in the tree: in O(1) if it is Sized, else by
+ * counting them in O(n)
+ */
+template <class Key, class Value, class Compare, bool Sized>
+std::size_t BinarySearchTree<Key, Value, Compare, Sized>::size() const {
+    if constexpr (Sized) {
+        return subtree_size(root_);
+    } else {
+        return count_nodes(std::numeric_limits<std::size_t>::max());
+    }
+}
+
+/**
+ * Returns the number of keys in the tree that are less than key, i.e. the
+ * position key has or would have in sorted order. Only for Sized trees.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+std::size_t
+BinarySearchTree<Key, Value, Compare, Sized>::rank(const Key& key) const {
+    static_assert(Sized, "rank needs a tree that keeps subtree sizes");
+    std::size_t result = 0;
+    Node<Key, Value>* node = root_;
+    while (node != nullptr) {
+        if (comp_(node->getKey(), key)) {
+            result += subtree_size(node->getLeft()) + 1;
+            node = node->getRight();
+        } else {
+            node = node->getLeft();
+        }
+    }
+    return result;
+}
+
+/**
+ * Returns an iterator to the item at position k (counting from 0) in sorted
+ * order, or the end iterator if k >= size(). Only for Sized trees.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::select(std::size_t k) const {
+    static_assert(Sized, "select needs a tree that keeps subtree sizes");
+    Node<Key, Value>* node = root_;
+    while (node != nullptr) {
+        std::size_t leftSize = subtree_size(node->getLeft());
+        if (k < leftSize) {
+            node = node->getLeft();
+        } else if (k == leftSize) {
+            break;
+        } else {
+            k -= leftSize + 1;
+            node = node->getRight();
+        }
+    }
+    return iterator(node);
+}
+
+template <typename Key, typename Value, typename Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::print() const {
     printRoot(root_);
     std::cout << "\n";
 }
@@ -347,20 +858,21 @@ void BinarySearchTree<Key, Value>::print() const {
 /**
  * Returns an iterator to the "smallest" item in the tree
  */
-template <class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::begin() const {
+    BinarySearchTree<Key, Value, Compare, Sized>::iterator begin(
+        getSmallestNode());
     return begin;
 }
 
 /**
  * Returns an iterator whose value means INVALID
  */
-template <class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::end() const {
+    BinarySearchTree<Key, Value, Compare, Sized>::iterator end(NULL);
     return end;
 }
 
@@ -368,27 +880,196 @@ BinarySearchTree<Key, Value>::end() const {
  * Returns an iterator to the item with the given key, k
  * or the end iterator if k does not exist in the tree
  */
-template <class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key& k) const {
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::find(const Key& k) const {
     Node<Key, Value>* curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    BinarySearchTree<Key, Value, Compare, Sized>::iterator it(curr);
     return it;
 }
 
+/**
+ * Like find(const Key&), for a key of another type. Only there when Compare
+ * is transparent.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+template <typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::find(const K& k) const {
+    return iterator(internalFind(k));
+}
+
+/**
+ * Like find, but starts from hint and climbs only as far as it needs to
+ * before heading down, so it takes O(log d) in a balanced tree for a key d
+ * places away from hint instead of O(log n). Handy for walking through keys
+ * that are close together. end() stands for the largest item.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::find_from(iterator hint,
+                                                        const Key& key) const {
+    Node<Key, Value>* node = hint_node(hint);
+    if (node == nullptr) {
+        return end();
+    }
+    Node<Key, Value>* parent;
+    bool left;
+    return iterator(find_slot(key, climb(node, key), parent, left));
+}
+
+/**
+ * Looks up every key in [first, last) and writes an iterator for each to out,
+ * in the same order: the item with that key, or end(). Returns out advanced
+ * past them.
+ *
+ * The result is the same as calling find on each key, but the searches run
+ * 16 at a time in lockstep. Each round takes every search in the group one
+ * level down and prefetches the node it will look at next, so their cache
+ * misses overlap instead of each search waiting on one per level in turn.
+ * The gain is largest once the tree no longer fits in cache.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+template <typename ForwardIt, typename OutputIt>
+OutputIt
+BinarySearchTree<Key, Value, Compare, Sized>::find_batch(ForwardIt first,
+                                                         ForwardIt last,
+                                                         OutputIt out) const {
+    ForwardIt keys[find_batch_group];
+    Node<Key, Value>* nodes[find_batch_group];
+    // The last node each search went right at, the only one that can hold
+    // its key (see find_slot)
+    Node<Key, Value>* found[find_batch_group];
+    while (first != last) {
+        std::size_t count = 0;
+        for (; count < find_batch_group && first != last; ++first, ++count) {
+            keys[count] = first;
+            nodes[count] = root_;
+            found[count] = nullptr;
+        }
+        for (bool moving = root_ != nullptr; moving;) {
+            moving = false;
+            for (std::size_t i = 0; i < count; i++) {
+                Node<Key, Value>* node = nodes[i];
+                if (node == nullptr) {
+                    continue;
+                }
+                if (comp_(*keys[i], node->getKey())) {
+                    node = node->getLeft();
+                } else {
+                    found[i] = node;
+                    node = node->getRight();
+                }
+                if (node != nullptr) {
+#if defined(__GNUC__)
+                    __builtin_prefetch(node);
+#endif
+                    moving = true;
+                }
+                nodes[i] = node;
+            }
+        }
+        for (std::size_t i = 0; i < count; i++) {
+            Node<Key, Value>* node = found[i];
+            if (node != nullptr && comp_(node->getKey(), *keys[i])) {
+                node = nullptr;
+            }
+            *out++ = iterator(node);
+        }
+    }
+    return out;
+}
+
+/**
+ * Returns an iterator to the first item whose key is not less than key, or
+ * the end iterator if there is none
+ */
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::lower_bound(
+    const Key& key) const {
+    return iterator(lower_bound_node(key));
+}
+
+/**
+ * Returns an iterator to the first item whose key is greater than key, or the
+ * end iterator if there is none
+ */
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::upper_bound(
+    const Key& key) const {
+    return iterator(upper_bound_node(key));
+}
+
+/**
+ * Returns the range of items with the given key, which is either empty or
+ * holds a single item
+ */
+template <class Key, class Value, class Compare, bool Sized>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Sized>::iterator,
+          typename BinarySearchTree<Key, Value, Compare, Sized>::iterator>
+BinarySearchTree<Key, Value, Compare, Sized>::equal_range(
+    const Key& key) const {
+    return std::make_pair(lower_bound(key), upper_bound(key));
+}
+
+/**
+ * The lower_bound, upper_bound and equal_range above, for keys of another
+ * type. Only there when Compare is transparent.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+template <typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::lower_bound(const K& key) const {
+    return iterator(lower_bound_node(key));
+}
+
+template <class Key, class Value, class Compare, bool Sized>
+template <typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::upper_bound(const K& key) const {
+    return iterator(upper_bound_node(key));
+}
+
+template <class Key, class Value, class Compare, bool Sized>
+template <typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Sized>::iterator,
+          typename BinarySearchTree<Key, Value, Compare, Sized>::iterator>
+BinarySearchTree<Key, Value, Compare, Sized>::equal_range(const K& key) const {
+    return std::make_pair(lower_bound(key), upper_bound(key));
+}
+
+/**
+ * Returns a view of the items with lo <= key <= hi. Finding the ends costs
+ * O(log n) in a balanced tree, and iterating over the view only visits the
+ * matching items.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::range_view
+BinarySearchTree<Key, Value, Compare, Sized>::range(
+    const Key& lo, const Key& hi) const {
+    if (comp_(hi, lo)) {
+        return range_view(end(), end());
+    }
+    return range_view(lower_bound(lo), upper_bound(hi));
+}
+
 /**
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template <class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key) {
+template <class Key, class Value, class Compare, bool Sized>
+Value&
+BinarySearchTree<Key, Value, Compare, Sized>::operator[](const Key& key) {
     Node<Key, Value>* curr = internalFind(key);
     if (curr == NULL)
         throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template <class Key, class Value>
-Value const& BinarySearchTree<Key, Value>::operator[](const Key& key) const {
+template <class Key, class Value, class Compare, bool Sized>
+Value const&
+BinarySearchTree<Key, Value, Compare, Sized>::operator[](const Key& key) const {
     Node<Key, Value>* curr = internalFind(key);
     if (curr == NULL)
         throw std::out_of_range("Invalid key");
@@ -401,37 +1082,202 @@ Value const& BinarySearchTree<Key, Value>::operator[](const Key& key) const {
  * Recall: If key is already in the tree, you should
  * overwrite the current value with the updated value.
  */
-template <class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(
+template <class Key, class Value, class Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::insert(
     const std::pair<const Key, Value>& keyValuePair) {
+    CopiedItem<Key, Value> maker(keyValuePair.first, keyValuePair.second);
+    bool inserted;
+    insert_item(maker, nullptr, inserted);
+}
+
+/**
+ * Inserts or overwrites like the version above, but takes a
+ * std::pair<Key, Value>: an rvalue has its key and value moved into a new
+ * node, or its value move-assigned over an existing one.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+template <typename Pair, typename>
+void BinarySearchTree<Key, Value, Compare, Sized>::insert(Pair&& keyValuePair) {
+    ForwardedItem<Key, Value, Pair> maker(std::forward<Pair>(keyValuePair));
+    bool inserted;
+    insert_item(maker, nullptr, inserted);
+}
+
+/**
+ * Inserts or overwrites like insert, but looks for the key's place starting
+ * from hint rather than from the root (see find_from), and returns an
+ * iterator to the item. end() stands for the largest item, so appending keys
+ * in order with insert(end(), ...) is cheap.
+ *
+ * Plain insert has a similar shortcut of its own: when a key belongs right
+ * next to the one inserted last, as in an ascending or descending stream, it
+ * starts there without a hint.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::insert(
+    iterator hint, const std::pair<const Key, Value>& keyValuePair) {
+    CopiedItem<Key, Value> maker(keyValuePair.first, keyValuePair.second);
+    bool inserted;
+    return iterator(insert_item(maker, hint_node(hint), inserted));
+}
+
+/**
+ * The hinted insert for a std::pair<Key, Value>, moving from an rvalue.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+template <typename Pair, typename>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::insert(iterator hint,
+                                                     Pair&& keyValuePair) {
+    ForwardedItem<Key, Value, Pair> maker(std::forward<Pair>(keyValuePair));
+    bool inserted;
+    return iterator(insert_item(maker, hint_node(hint), inserted));
+}
+
+/**
+ * Inserts a std::pair<Key, Value> built from args, unless its key is already
+ * there, in which case the tree is left alone (like std::map, and unlike
+ * insert). The key isn't known until the pair exists, so the pair is built
+ * first and then moved into the node; try_emplace avoids even that. Returns
+ * an iterator to the item with that key and whether it was inserted.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+template <typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Sized>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Sized>::emplace(Args&&... args) {
+    std::pair<Key, Value> item(std::forward<Args>(args)...);
+    return try_emplace(std::move(item.first), std::move(item.second));
+}
+
+/**
+ * If key isn't there, inserts it with a value constructed in the node from
+ * args. Otherwise does nothing, and in particular doesn't touch args. Returns
+ * an iterator to the item with that key and whether it was inserted.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+template <typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Sized>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Sized>::try_emplace(const Key& key,
+                                                          Args&&... args) {
+    EmplacedItem<Key, Value, const Key&, Args...> maker(
+        key, std::forward<Args>(args)...);
+    bool inserted;
+    Node<Key, Value>* node = insert_item(maker, nullptr, inserted);
+    return std::make_pair(iterator(node), inserted);
+}
+
+template <class Key, class Value, class Compare, bool Sized>
+template <typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Sized>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Sized>::try_emplace(Key&& key,
+                                                          Args&&... args) {
+    EmplacedItem<Key, Value, Key, Args...> maker(std::move(key),
+                                                 std::forward<Args>(args)...);
+    bool inserted;
+    Node<Key, Value>* node = insert_item(maker, nullptr, inserted);
+    return std::make_pair(iterator(node), inserted);
+}
+
+/**
+ * Inserts key with a value constructed from obj, or assigns obj to the value
+ * already there. Returns an iterator to the item and whether it is new.
+ */
+template <class Key, class Value, class Compare, bool Sized>
+template <typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Sized>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Sized>::insert_or_assign(const Key& key,
+                                                               M&& obj) {
+    AssignedItem<Key, Value, const Key&, M> maker(key, std::forward<M>(obj));
+    bool inserted;
+    Node<Key, Value>* node = insert_item(maker, nullptr, inserted);
+    return std::make_pair(iterator(node), inserted);
+}
+
+template <class Key, class Value, class Compare, bool Sized>
+template <typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Sized>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Sized>::insert_or_assign(Key&& key,
+                                                               M&& obj) {
+    AssignedItem<Key, Value, Key, M> maker(std::move(key),
+                                           std::forward<M>(obj));
+    bool inserted;
+    Node<Key, Value>* node = insert_item(maker, nullptr, inserted);
+    return std::make_pair(iterator(node), inserted);
+}
+
+template <class Key, class Value, class Compare, bool Sized>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Sized>::insert_item(
+    ItemMaker<Key, Value>& maker, Node<Key, Value>* hint, bool& inserted) {
     if (root_ == nullptr) {
-        root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second,
-                                     nullptr);
-    } else {
-        insert_helper(keyValuePair, root_);
+        root_ = create_node(maker, nullptr);
+        inserted = true;
+        finger_ = root_;
+        return root_;
     }
+    finger_ = insert_helper(maker, insert_start(maker.key(), hint), inserted);
+    if constexpr (Sized) {
+        if (inserted && rebalanceFactor_ > 0) {
+            auto_rebalance(finger_);
+        }
+    }
+    return finger_;
 }
 
-// Recursive helper function for insert
-template <class Key, class Value>
-void BinarySearchTree<Key, Value>::insert_helper(
-    const std::pair<const Key, Value>& keyValuePair, Node<Key, Value>* node) {
-    if (keyValuePair.first < node->getKey()) {
-        if (node->getLeft() == nullptr) {
-            node->setLeft(new Node<Key, Value>(keyValuePair.first,
-                                               keyValuePair.second, node));
-        } else {
-            insert_helper(keyValuePair, node->getLeft());
-        }
-    } else if (keyValuePair.first == node->getKey()) {
-        node->setValue(keyValuePair.second);
+// Iterative helper function for insert, so that degenerate (list-shaped) trees
+// can't overflow the stack
+template <class Key, class Value, class Compare, bool Sized>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Sized>::insert_helper(
+    ItemMaker<Key, Value>& maker, Node<Key, Value>* node, bool& inserted) {
+    Node<Key, Value>* parent;
+    bool left;
+    Node<Key, Value>* found = find_slot(maker.key(), node, parent, left);
+    if (found != nullptr) {
+        maker.found(found->getValue());
+        inserted = false;
+        return found;
+    }
+    Node<Key, Value>* n = create_node(maker, parent);
+    if (left) {
+        parent->setLeft(n);
     } else {
-        // keyValuePair.first > node->getKey()
-        if (node->getRight() == nullptr) {
-            node->setRight(new Node<Key, Value>(keyValuePair.first,
-                                                keyValuePair.second, node));
-        } else {
-            insert_helper(keyValuePair, node->getRight());
+        parent->setRight(n);
+    }
+    update_sizes(parent, 1, 0);
+    inserted = true;
+    return n;
+}
+
+// If node, just inserted, is deeper than setAutoRebalance allows, finds the
+// lowest ancestor whose subtree, counting down to node, is more than
+// factor * log2(size + 1) tall and taller than its size needs, and
+// rebalances that. That shortens node's path by at least one level. Only
+// small trees can be too tall and yet as short as possible, and those are
+// left alone.
+template <class Key, class Value, class Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::auto_rebalance(
+    Node<Key, Value>* node) {
+    int depth = 1;
+    for (Node<Key, Value>* p = node->getParent(); p != nullptr;
+         p = p->getParent()) {
+        depth++;
+    }
+    if (depth <= rebalanceFactor_ * std::log2((double)size() + 1)) {
+        return;
+    }
+    int height = 1;
+    for (Node<Key, Value>* p = node->getParent(); p != nullptr;
+         p = p->getParent()) {
+        height++;
+        std::size_t size = subtree_size(p);
+        double limit = rebalanceFactor_ * std::log2((double)size + 1);
+        // A subtree that needs more than height - 1 levels can't have
+        // height - 1 beyond the width of size_t
+        if (height > limit &&
+            (height > std::numeric_limits<std::size_t>::digits ||
+             size < (std::size_t)1 << (height - 1))) {
+            rebuild_subtree(p);
+            return;
         }
     }
 }
@@ -441,8 +1287,8 @@ void BinarySearchTree<Key, Value>::insert_helper(
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template <typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key) {
+template <typename Key, typename Value, typename Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::remove(const Key& key) {
     Node<Key, Value>* node = internalFind(key);
     if (node == nullptr) {
         // Do nothing
@@ -485,12 +1331,16 @@ void BinarySearchTree<Key, Value>::remove(const Key& key) {
             root_ = nullptr;
         }
     }
-    delete node;
+    update_sizes(node->getParent(), 0, 1);
+    if (node == finger_) {
+        finger_ = nullptr;
+    }
+    destroy_node(node);
 }
 
-template <class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current) {
+template <class Key, class Value, class Compare, bool Sized>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Sized>::predecessor(
+    Node<Key, Value>* current) {
     if (current->getLeft() != nullptr) {
         current = current->getLeft();
         while (current->getRight() != nullptr) {
@@ -506,9 +1356,9 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current) {
     }
 }
 
-template <class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current) {
+template <class Key, class Value, class Compare, bool Sized>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Sized>::successor(
+    Node<Key, Value>* current) {
     if (current->getRight() != nullptr) {
         current = current->getRight();
         while (current->getLeft() != nullptr) {
@@ -524,33 +1374,220 @@ BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current) {
     }
 }
 
+// Returns the number of nodes in the subtree at node, which may be NULL
+template <class Key, class Value, class Compare, bool Sized>
+std::size_t BinarySearchTree<Key, Value, Compare, Sized>::subtree_size(
+    Node<Key, Value>* node) {
+    static_assert(Sized, "only Sized trees keep subtree sizes");
+    return node == nullptr
+               ? 0
+               : static_cast<SizedNode<Key, Value>*>(node)->getSize();
+}
+
+// Adjusts the subtree sizes of node and all of its ancestors after nodes were
+// added to or removed from below it
+template <class Key, class Value, class Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::update_sizes(
+    Node<Key, Value>* node, std::size_t added, std::size_t removed) {
+    if constexpr (Sized) {
+        while (node != nullptr) {
+            SizedNode<Key, Value>* sized =
+                static_cast<SizedNode<Key, Value>*>(node);
+            sized->setSize(sized->getSize() + added - removed);
+            node = node->getParent();
+        }
+    }
+}
+
+template <class Key, class Value, class Compare, bool Sized>
+void
+BinarySearchTree<Key, Value, Compare, Sized>::recount(Node<Key, Value>* node) {
+    if constexpr (Sized) {
+        static_cast<SizedNode<Key, Value>*>(node)->setSize(
+            subtree_size(node->getLeft()) + subtree_size(node->getRight()) + 1);
+    }
+}
+
+// Counts the nodes in order, but stops at limit, so that a caller that only
+// needs to know whether there are at least limit of them doesn't walk the
+// rest of a big tree
+template <class Key, class Value, class Compare, bool Sized>
+std::size_t BinarySearchTree<Key, Value, Compare, Sized>::count_nodes(
+    std::size_t limit) const {
+    std::size_t count = 0;
+    for (Node<Key, Value>* node = getSmallestNode();
+         node != nullptr && count < limit; node = successor(node)) {
+        count++;
+    }
+    return count;
+}
+
+// The height of a tree of size nodes with every level full but the last
+template <class Key, class Value, class Compare, bool Sized>
+int BinarySearchTree<Key, Value, Compare, Sized>::min_height(std::size_t size) {
+    int height = 0;
+    for (; size > 0; size /= 2) {
+        height++;
+    }
+    return height;
+}
+
 /**
  * A method to remove all contents of the tree and
  * reset the values in the tree for use again.
+ * If the tree is the only user of a pool allocator and its nodes don't need
+ * destructors run, the pool's chunks are dropped wholesale instead of walking
+ * the tree.
  */
-template <typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear() {
-    clear_helper(root_);
+template <typename Key, typename Value, typename Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::clear() {
+    if (root_ == nullptr) {
+        return;
+    }
+    if (!(alloc_.use_count() == 1 && trivialNodes_ && alloc_->release())) {
+        clear_helper(root_);
+    }
     root_ = nullptr;
+    finger_ = nullptr;
 }
 
-// Recursive helper function for clear
-template <typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear_helper(Node<Key, Value>* node) {
+// Iterative helper function for clear. Frees the subtree at node bottom-up by
+// always descending to a leaf, unlinking it and stepping back to its parent,
+// so it needs no stack at all.
+template <typename Key, typename Value, typename Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::clear_helper(
+    Node<Key, Value>* node) {
     if (node == nullptr) {
-        // Base case
         return;
     }
-    clear_helper(node->getLeft());
-    clear_helper(node->getRight());
-    delete node;
+    Node<Key, Value>* stop = node->getParent();
+    while (node != stop) {
+        if (node->getLeft() != nullptr) {
+            node = node->getLeft();
+        } else if (node->getRight() != nullptr) {
+            node = node->getRight();
+        } else {
+            Node<Key, Value>* parent = node->getParent();
+            if (parent != nullptr) {
+                if (parent->getLeft() == node) {
+                    parent->setLeft(nullptr);
+                } else {
+                    parent->setRight(nullptr);
+                }
+            }
+            destroy_node(node);
+            node = parent;
+        }
+    }
+}
+
+/**
+ * Replaces the contents of the tree with the items in [first, last), which
+ * must be sorted by strictly increasing key. The items are laid out as a
+ * perfectly balanced tree in linear time, without any comparisons.
+ */
+template <typename Key, typename Value, typename Compare, bool Sized>
+template <typename ForwardIt>
+void BinarySearchTree<Key, Value, Compare, Sized>::build_from_sorted(
+    ForwardIt first, ForwardIt last) {
+    clear();
+    root_ = build_helper(first, std::distance(first, last), nullptr);
+}
+
+// Recursive helper function for build_from_sorted. Builds a tree from the next
+// n items, advancing first past them, and returns its root. The recursion is
+// only as deep as the balanced tree it builds.
+template <typename Key, typename Value, typename Compare, bool Sized>
+template <typename ForwardIt>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Sized>::build_helper(
+    ForwardIt& first, std::size_t n, Node<Key, Value>* parent) {
+    if (n == 0) {
+        return nullptr;
+    }
+    std::size_t leftCount = n / 2;
+    Node<Key, Value>* left = build_helper(first, leftCount, nullptr);
+    CopiedItem<Key, Value> maker(first->first, first->second);
+    Node<Key, Value>* node = create_node(maker, parent);
+    ++first;
+    Node<Key, Value>* right = build_helper(first, n - leftCount - 1, node);
+    node->setLeft(left);
+    if (left != nullptr) {
+        left->setParent(node);
+    }
+    node->setRight(right);
+    recount(node);
+    build_fix(node, leftCount, n - leftCount - 1);
+    return node;
+}
+
+/**
+ * Plain BSTs keep no balance information.
+ */
+template <typename Key, typename Value, typename Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::build_fix(
+    Node<Key, Value>* node, std::size_t leftSize, std::size_t rightSize) {}
+
+/**
+ * Makes the tree's nodes NodeType, which must derive from Node and be
+ * constructible from an ItemMaker and a NodeType* parent. Constructors call
+ * it while the tree is still empty.
+ */
+template <typename Key, typename Value, typename Compare, bool Sized>
+template <typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Sized>::use_nodes() {
+    static_assert(std::is_base_of<Node<Key, Value>, NodeType>::value,
+                  "the nodes of a tree must derive from Node");
+    makeNode_ = &make_node<NodeType>;
+    unmakeNode_ = &unmake_node<NodeType>;
+    trivialNodes_ = std::is_trivially_destructible<NodeType>::value;
+}
+
+/**
+ * Allocates a node from the tree's allocator and has maker build its item.
+ */
+template <typename Key, typename Value, typename Compare, bool Sized>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Sized>::create_node(
+    ItemMaker<Key, Value>& maker, Node<Key, Value>* parent) {
+    return makeNode_(*alloc_, maker, parent);
+}
+
+/**
+ * Destroys a node made by create_node and hands its memory back.
+ */
+template <typename Key, typename Value, typename Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::destroy_node(
+    Node<Key, Value>* node) {
+    unmakeNode_(node);
+    alloc_->deallocate(node);
+}
+
+template <typename Key, typename Value, typename Compare, bool Sized>
+template <typename NodeType>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Sized>::make_node(
+    NodeAllocator& alloc, ItemMaker<Key, Value>& maker,
+    Node<Key, Value>* parent) {
+    void* block = alloc.allocate(sizeof(NodeType));
+    try {
+        return new (block) NodeType(maker, static_cast<NodeType*>(parent));
+    } catch (...) {
+        alloc.deallocate(block);
+        throw;
+    }
+}
+
+template <typename Key, typename Value, typename Compare, bool Sized>
+template <typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Sized>::unmake_node(
+    Node<Key, Value>* node) {
+    static_cast<NodeType*>(node)->~NodeType();
 }
 
 /**
  * A helper function to find the smallest node in the tree.
  */
-template <typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::getSmallestNode() const {
+template <typename Key, typename Value, typename Compare, bool Sized>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Sized>::getSmallestNode() const {
     if (root_ == nullptr) {
         return nullptr;
     }
@@ -563,73 +1600,441 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::getSmallestNode() const {
     return node;
 }
 
+// Climbs from node towards the root until key is inside the current subtree.
+// That subtree is bounded on key's side by the first ancestor it hangs on the
+// other side of, so only those ancestors are compared with key.
+template <typename Key, typename Value, typename Compare, bool Sized>
+template <typename K>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Sized>::climb(Node<Key, Value>* node,
+                                                    const K& key) const {
+    bool up = comp_(node->getKey(), key);
+    if (!up && !comp_(key, node->getKey())) {
+        return node;
+    }
+    while (true) {
+        Node<Key, Value>* child = node;
+        Node<Key, Value>* bound = node->getParent();
+        while (bound != nullptr &&
+               child == (up ? bound->getRight() : bound->getLeft())) {
+            child = bound;
+            bound = bound->getParent();
+        }
+        if (bound == nullptr) {
+            return node;
+        }
+        const Key& b = bound->getKey();
+        if (up ? comp_(key, b) : comp_(b, key)) {
+            return node;
+        }
+        if (!(up ? comp_(b, key) : comp_(key, b))) {
+            return bound;
+        }
+        node = bound;
+    }
+}
+
+// The last-insert shortcut costs a comparison or two when it doesn't apply,
+// and saves the whole descent from the root when it does.
+template <typename Key, typename Value, typename Compare, bool Sized>
+template <typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Sized>::insert_start(
+    const K& key, Node<Key, Value>* hint) const {
+    if (hint != nullptr) {
+        return climb(hint, key);
+    }
+    Node<Key, Value>* node = finger_;
+    if (node == nullptr) {
+        return root_;
+    }
+    if (comp_(node->getKey(), key)) {
+        if (node->getRight() == nullptr) {
+            Node<Key, Value>* next = successor(node);
+            if (next == nullptr || comp_(key, next->getKey())) {
+                return node;
+            }
+        }
+    } else if (comp_(key, node->getKey())) {
+        if (node->getLeft() == nullptr) {
+            Node<Key, Value>* prev = predecessor(node);
+            if (prev == nullptr || comp_(prev->getKey(), key)) {
+                return node;
+            }
+        }
+    } else {
+        return node;
+    }
+    return root_;
+}
+
+template <typename Key, typename Value, typename Compare, bool Sized>
+typename BinarySearchTree<Key, Value, Compare, Sized>::iterator
+BinarySearchTree<Key, Value, Compare, Sized>::node_iterator(
+    Node<Key, Value>* node) {
+    return iterator(node);
+}
+
+// The node an iterator hint stands for. end() stands for the largest node.
+template <typename Key, typename Value, typename Compare, bool Sized>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Sized>::hint_node(iterator hint) const {
+    Node<Key, Value>* node = hint.current_;
+    if (node == nullptr && root_ != nullptr) {
+        node = root_;
+        while (node->getRight() != nullptr) {
+            node = node->getRight();
+        }
+    }
+    return node;
+}
+
+/**
+ * Helper function to find the node with the smallest key that is not less
+ * than key, or NULL if there is none
+ */
+template <typename Key, typename Value, typename Compare, bool Sized>
+template <typename K>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Sized>::lower_bound_node(
+    const K& key) const {
+    Node<Key, Value>* node = root_;
+    Node<Key, Value>* result = nullptr;
+    while (node != nullptr) {
+        if (comp_(node->getKey(), key)) {
+            node = node->getRight();
+        } else {
+            result = node;
+            node = node->getLeft();
+        }
+    }
+    return result;
+}
+
+/**
+ * Helper function to find the node with the smallest key that is greater than
+ * key, or NULL if there is none
+ */
+template <typename Key, typename Value, typename Compare, bool Sized>
+template <typename K>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Sized>::upper_bound_node(
+    const K& key) const {
+    Node<Key, Value>* node = root_;
+    Node<Key, Value>* result = nullptr;
+    while (node != nullptr) {
+        if (comp_(key, node->getKey())) {
+            result = node;
+            node = node->getLeft();
+        } else {
+            node = node->getRight();
+        }
+    }
+    return result;
+}
+
 /**
  * Helper function to find a node with given key, k and
  * return a pointer to it or NULL if no item with that key
  * exists
  */
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Compare, bool Sized>
+template <typename K>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::internalFind(const Key& key) const {
-    return internalFind_helper(key, root_);
+BinarySearchTree<Key, Value, Compare, Sized>::internalFind(const K& key) const {
+    if (root_ == nullptr) {
+        return nullptr;
+    }
+    Node<Key, Value>* parent;
+    bool left;
+    return find_slot(key, root_, parent, left);
 }
 
-// Recursive helper function for internalFind
-template <typename Key, typename Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::internalFind_helper(const Key& key,
-                                                  Node<Key, Value>* node) {
-    if (node == nullptr) {
+// Searches the subtree at node, which must not be NULL, for key. Returns the
+// node holding it, or else NULL with parent set to the leaf that a new node
+// for key would hang from, and left to the side it would go on.
+template <typename Key, typename Value, typename Compare, bool Sized>
+template <typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Sized>::find_slot(
+    const K& key, Node<Key, Value>* node, Node<Key, Value>*& parent,
+    bool& left) const {
+    typedef KeyOrder<Compare, K, Key> Order;
+    if constexpr (Order::exact) {
+        while (true) {
+            int order = Order::order(comp_, key, node->getKey());
+            if (order == 0) {
+                return node;
+            }
+            left = order < 0;
+            Node<Key, Value>* next = left ? node->getLeft() : node->getRight();
+            if (next == nullptr) {
+                parent = node;
+                return nullptr;
+            }
+            node = next;
+        }
+    } else {
+        // Go right whenever key isn't less. The last node that happened at
+        // is the only one that can hold key.
+        Node<Key, Value>* last = nullptr;
+        while (true) {
+            left = comp_(key, node->getKey());
+            if (!left) {
+                last = node;
+            }
+            Node<Key, Value>* next = left ? node->getLeft() : node->getRight();
+            if (next == nullptr) {
+                break;
+            }
+            node = next;
+        }
+        if (last != nullptr && !comp_(last->getKey(), key)) {
+            return last;
+        }
+        parent = node;
         return nullptr;
-    } else if (key < node->getKey()) {
-        return internalFind_helper(key, node->getLeft());
-    } else if (key == node->getKey()) {
-        return node;
+    }
+}
+
+/**
+ * Reshapes the tree into one of minimum height, with every level full except
+ * perhaps the last, whose nodes are as far left as they go (Day, Stout and
+ * Warren). The nodes are relinked rather than copied, so iterators stay
+ * valid. Takes O(n) time and O(1) extra space, and makes no comparisons.
+ */
+template <typename Key, typename Value, typename Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::rebalance() {
+    rebuild_subtree(root_);
+}
+
+/**
+ * Makes plain BinarySearchTree's inserts keep the tree's height within
+ * factor * log2(size + 1); removes don't check it. When an insert goes
+ * deeper than that, as inserts of keys in order soon do, the lowest subtree
+ * above the new node that is too tall for its size gets rebalanced, not the
+ * whole tree, which keeps inserts O(log n) amortized. factor must be
+ * greater than 1, since no tree is shallower than log2(size + 1); the closer
+ * it is to 1, the more often subtrees get rebuilt. 2 is a sensible choice.
+ * 0, the default, turns it off. Trees that balance themselves ignore it.
+ * The subtrees are judged by their sizes, so the tree must be Sized.
+ */
+template <typename Key, typename Value, typename Compare, bool Sized>
+void
+BinarySearchTree<Key, Value, Compare, Sized>::setAutoRebalance(double factor) {
+    static_assert(Sized,
+                  "setAutoRebalance needs a tree that keeps subtree sizes");
+    if (!(factor == 0 || factor > 1)) {
+        throw std::invalid_argument("factor must be 0 or greater than 1");
+    }
+    rebalanceFactor_ = factor;
+}
+
+// Calls build_fix on each node of the rebuilt subtree. The vine that it is
+// first straightened into is n nodes long, counted on the way. A pass of left
+// rotations at every other node from its top turns the ones beyond the
+// largest perfect tree that fits into leaves of the bottom level, and each
+// pass after that halves what is left of the spine, until the perfect tree
+// above them is finished.
+template <typename Key, typename Value, typename Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::rebuild_subtree(
+    Node<Key, Value>* top) {
+    if (top == nullptr) {
+        return;
+    }
+    Node<Key, Value>* above = top->getParent();
+    std::size_t n;
+    top = tree_to_vine(above, top, n);
+    std::size_t perfect = 1;
+    while (perfect <= (n + 1) / 2) {
+        perfect *= 2;
+    }
+    perfect -= 1;
+    top = compress(above, top, n - perfect);
+    for (std::size_t m = perfect / 2; m > 0; m /= 2) {
+        top = compress(above, top, m);
+    }
+    rebalance_fix(top);
+}
+
+// Helper function for rebuild_subtree. Rotates right at every node of the
+// right spine of the subtree at top that has a left child until there are
+// none, which leaves all of its nodes on the spine in key order: a vine.
+// Returns the vine's top, and its length in n.
+template <typename Key, typename Value, typename Compare, bool Sized>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Sized>::tree_to_vine(
+    Node<Key, Value>* above, Node<Key, Value>* top, std::size_t& n) {
+    Node<Key, Value>* tail = above;
+    Node<Key, Value>* rest = top;
+    n = 0;
+    while (rest != nullptr) {
+        Node<Key, Value>* left = rest->getLeft();
+        if (left == nullptr) {
+            n++;
+            tail = rest;
+            rest = rest->getRight();
+            continue;
+        }
+        rest->setLeft(left->getRight());
+        if (left->getRight() != nullptr) {
+            left->getRight()->setParent(rest);
+        }
+        left->setRight(rest);
+        replace_child(tail, rest, left);
+        rest->setParent(left);
+        left->setParent(tail);
+        if (rest == top) {
+            top = left;
+        }
+        rest = left;
+    }
+    return top;
+}
+
+// Helper function for rebuild_subtree. Rotates left at count nodes down
+// the right spine below above, every other one starting from top, so that
+// each moves below the node that followed it. Returns the new top.
+template <typename Key, typename Value, typename Compare, bool Sized>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Sized>::compress(Node<Key, Value>* above,
+                                                       Node<Key, Value>* top,
+                                                       std::size_t count) {
+    Node<Key, Value>* parent = above;
+    Node<Key, Value>* node = top;
+    for (std::size_t i = 0; i < count; i++) {
+        Node<Key, Value>* child = node->getRight();
+        node->setRight(child->getLeft());
+        if (child->getLeft() != nullptr) {
+            child->getLeft()->setParent(node);
+        }
+        child->setLeft(node);
+        replace_child(parent, node, child);
+        node->setParent(child);
+        child->setParent(parent);
+        if (i == 0) {
+            top = child;
+        }
+        parent = child;
+        node = child->getRight();
+    }
+    return top;
+}
+
+// Makes to_node take from_node's place below parent, or at the root if
+// parent is NULL
+template <typename Key, typename Value, typename Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::replace_child(
+    Node<Key, Value>* parent, Node<Key, Value>* from_node,
+    Node<Key, Value>* to_node) {
+    if (parent == nullptr) {
+        root_ = to_node;
+    } else if (parent->getLeft() == from_node) {
+        parent->setLeft(to_node);
     } else {
-        // key > node->getKey()
-        return internalFind_helper(key, node->getRight());
+        parent->setRight(to_node);
+    }
+}
+
+// Helper function for rebuild_subtree. Walks the subtree at top in
+// post-order with the parent pointers, counting the size of each subtree
+// from its children's and calling build_fix just as build_from_sorted would
+// (and recount, as the rotations left stored sizes wrong). The sizes of the
+// finished subtrees wait on a stack, which never holds more than one per
+// level plus one: every subtree is now of minimum height, so there are at
+// most as many levels as bits in a size_t.
+template <typename Key, typename Value, typename Compare, bool Sized>
+void BinarySearchTree<Key, Value, Compare, Sized>::rebalance_fix(
+    Node<Key, Value>* top) {
+    std::size_t sizes[std::numeric_limits<std::size_t>::digits + 1];
+    int count = 0;
+    Node<Key, Value>* stop = top->getParent();
+    Node<Key, Value>* node = top;
+    Node<Key, Value>* prev = stop;
+    while (node != stop) {
+        Node<Key, Value>* parent = node->getParent();
+        Node<Key, Value>* left = node->getLeft();
+        Node<Key, Value>* right = node->getRight();
+        if (prev == parent && left != nullptr) {
+            prev = node;
+            node = left;
+            continue;
+        }
+        if ((prev == parent || prev == left) && right != nullptr) {
+            prev = node;
+            node = right;
+            continue;
+        }
+        std::size_t rightSize = right != nullptr ? sizes[--count] : 0;
+        std::size_t leftSize = left != nullptr ? sizes[--count] : 0;
+        sizes[count++] = leftSize + rightSize + 1;
+        recount(node);
+        build_fix(node, leftSize, rightSize);
+        prev = node;
+        node = parent;
     }
 }
 
 /**
  * Return true iff the BST is balanced.
  */
-template <typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const {
+template <typename Key, typename Value, typename Compare, bool Sized>
+bool BinarySearchTree<Key, Value, Compare, Sized>::isBalanced() const {
     return isBalanced_helper(root_) != -1;
 }
 
-// Recursive helper function for isBalanced
+// Iterative helper function for isBalanced
 // Returns -1 if the (sub)tree is not balanced, otherwise returns the height of
 // the tree
-template <typename Key, typename Value>
-int BinarySearchTree<Key, Value>::isBalanced_helper(Node<Key, Value>* node) {
+// Walks the tree in post-order using the parent pointers, keeping the heights
+// of finished subtrees on an explicit stack.
+template <typename Key, typename Value, typename Compare, bool Sized>
+int BinarySearchTree<Key, Value, Compare, Sized>::isBalanced_helper(
+    Node<Key, Value>* node) {
     if (node == nullptr) {
         return 0;
     }
-    int left = isBalanced_helper(node->getLeft());
-    int right = isBalanced_helper(node->getRight());
-    if (left == -1 || right == -1) {
-        return -1;
-    }
-    if (left < right) {
-        if (right - left > 1) {
-            return -1;
-        } else {
-            return right + 1;
+    std::vector<int> heights;
+    Node<Key, Value>* stop = node->getParent();
+    Node<Key, Value>* prev = stop;
+    while (node != stop) {
+        Node<Key, Value>* parent = node->getParent();
+        Node<Key, Value>* left = node->getLeft();
+        Node<Key, Value>* right = node->getRight();
+        if (prev == parent) {
+            // First visit: go left
+            if (left != nullptr) {
+                prev = node;
+                node = left;
+                continue;
+            }
+            heights.push_back(0);
         }
-    } else {
-        if (left - right > 1) {
+        if (prev == parent || (left != nullptr && prev == left)) {
+            // Left subtree is done: go right
+            if (right != nullptr) {
+                prev = node;
+                node = right;
+                continue;
+            }
+            heights.push_back(0);
+        }
+        // Both subtrees are done
+        int rightHeight = heights.back();
+        heights.pop_back();
+        int leftHeight = heights.back();
+        heights.pop_back();
+        if (leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1) {
             return -1;
-        } else {
-            return left + 1;
         }
+        heights.push_back(std::max(leftHeight, rightHeight) + 1);
+        prev = node;
+        node = parent;
     }
+    return heights.back();
 }
 
-template <typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap(Node<Key, Value>* n1,
-                                            Node<Key, Value>* n2) {
+template <typename Key, typename Value, typename Compare, bool Sized>
+void
+BinarySearchTree<Key, Value, Compare, Sized>::nodeSwap(Node<Key, Value>* n1,
+                                                       Node<Key, Value>* n2) {
     if ((n1 == n2) || (n1 == NULL) || (n2 == NULL)) {
         return;
     }
@@ -659,6 +2064,15 @@ void BinarySearchTree<Key, Value>::nodeSwap(Node<Key, Value>* n1,
     n1->setRight(n2->getRight());
     n2->setRight(temp);
 
+    // Subtree sizes belong to the positions, not the nodes
+    if constexpr (Sized) {
+        SizedNode<Key, Value>* s1 = static_cast<SizedNode<Key, Value>*>(n1);
+        SizedNode<Key, Value>* s2 = static_cast<SizedNode<Key, Value>*>(n2);
+        std::size_t tempSize = s1->getSize();
+        s1->setSize(s2->getSize());
+        s2->setSize(tempSize);
+    }
+
     if ((n1r != NULL && n1r == n2)) {
         n2->setRight(n1);
         n1->setParent(n2);
@@ -0,0 +1,614 @@
+#ifndef COMPACT_AVLBST_H
+#define COMPACT_AVLBST_H
+
+#include "node_writes.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * An AVL tree with small nodes, for when memory per key matters more than
+ * anything else.
+ *
+ * Nodes live in a pool of fixed-size chunks and link to each other by 32-bit
+ * index instead of by pointer. The balance takes the top two bits of the
+ * right link, and there is no parent link at all: insert and remove remember
+ * the path they came down on a small stack, and iterators carry their own
+ * stack of the ancestors still to visit. A node is just the item plus eight
+ * bytes, so a <uint32_t, uint32_t> node takes 16 bytes where an AVLNode
+ * takes 40.
+ *
+ * The indexes limit the tree to 2^30 - 1 nodes. Like the other trees,
+ * iterators are invalidated by insert and remove.
+ */
+template <class Key, class Value> class CompactAVLTree {
+    // Longest path in an AVL tree of 2^30 nodes, with room to spare
+    static const int kMaxHeight = 64;
+
+  public:
+    CompactAVLTree();
+    ~CompactAVLTree();
+
+    void insert(const std::pair<const Key, Value>& new_item);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    std::size_t size() const;
+    std::size_t memory_used() const;
+    bool isBalanced() const;
+
+    /**
+     * Walks the tree in order with a stack of node indexes: the current node
+     * on top, and below it the ancestors whose left subtree we're in.
+     */
+    class iterator {
+      public:
+        iterator();
+
+        std::pair<const Key, Value>& operator*() const;
+        std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+      private:
+        friend class CompactAVLTree<Key, Value>;
+        explicit iterator(const CompactAVLTree<Key, Value>* tree);
+        void push_leftmost(uint32_t node);
+        uint32_t current() const;
+
+        const CompactAVLTree<Key, Value>* tree_;
+        uint32_t stack_[kMaxHeight];
+        int depth_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const& operator[](const Key& key) const;
+
+  private:
+    static const uint32_t NIL = 0;         // index 0 is never used
+    static const uint32_t kIndexMask = 0x3fffffff;
+    static const int kBalanceShift = 30;
+    static const std::size_t kChunkBits = 12; // 4096 nodes per chunk
+
+    struct CNode {
+        std::pair<const Key, Value> item;
+        uint32_t left;
+        uint32_t rightAndBalance; // right index, and balance + 1 on top
+    };
+    typedef typename std::aligned_storage<sizeof(CNode),
+                                          alignof(CNode)>::type Storage;
+
+    CompactAVLTree(const CompactAVLTree&);
+    CompactAVLTree& operator=(const CompactAVLTree&);
+
+    CNode& at(uint32_t index) const;
+    uint32_t left(uint32_t index) const;
+    uint32_t right(uint32_t index) const;
+    int balance(uint32_t index) const;
+    void set_left(uint32_t index, uint32_t child);
+    void set_right(uint32_t index, uint32_t child);
+    void set_balance(uint32_t index, int balance);
+    void set_child(uint32_t index, int dir, uint32_t child);
+    void replace_link(const uint32_t* path, const int* dirs, int depth,
+                      uint32_t child);
+
+    uint32_t allocate(const std::pair<const Key, Value>& item);
+    void release(uint32_t index);
+    uint32_t find_node(const Key& key) const;
+    uint32_t rotate_left(uint32_t x);
+    uint32_t rotate_right(uint32_t y);
+    uint32_t rebalance(uint32_t node, int balance);
+    int check_height(uint32_t node, bool& balanced) const;
+
+    std::vector<std::unique_ptr<Storage[]> > chunks_;
+    uint32_t root_;
+    uint32_t next_;     // first index never handed out
+    uint32_t freeList_; // freed nodes, linked through left
+    std::size_t size_;
+};
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the CompactAVLTree class.
+  ------------------------------------------------------
+*/
+
+template <class Key, class Value>
+CompactAVLTree<Key, Value>::CompactAVLTree()
+    : root_(NIL), next_(1), freeList_(NIL), size_(0) {}
+
+template <class Key, class Value>
+CompactAVLTree<Key, Value>::~CompactAVLTree() {
+    clear();
+}
+
+/**
+ * Inserts or overwrites an item. Goes down recording the path, adds a leaf,
+ * and walks back up the path fixing balances, rotating at most once.
+ */
+template <class Key, class Value>
+void CompactAVLTree<Key, Value>::insert(
+    const std::pair<const Key, Value>& new_item) {
+    uint32_t path[kMaxHeight];
+    int dirs[kMaxHeight]; // 0 if we went left, 1 if right
+    int depth = 0;
+    for (uint32_t n = root_; n != NIL;) {
+        CNode& node = at(n);
+        if (new_item.first < node.item.first) {
+            dirs[depth] = 0;
+        } else if (node.item.first < new_item.first) {
+            dirs[depth] = 1;
+        } else {
+            node.item.second = new_item.second;
+            return;
+        }
+        path[depth++] = n;
+        n = dirs[depth - 1] ? right(n) : left(n);
+    }
+
+    replace_link(path, dirs, depth, allocate(new_item));
+    size_++;
+
+    for (int i = depth - 1; i >= 0; i--) {
+        uint32_t p = path[i];
+        int b = balance(p) + (dirs[i] ? 1 : -1);
+        if (b == 0) {
+            set_balance(p, 0);
+            return;
+        }
+        if (b == 1 || b == -1) {
+            set_balance(p, b);
+            continue;
+        }
+        // A rotation after an insert restores the subtree's old height
+        replace_link(path, dirs, i, rebalance(p, b));
+        return;
+    }
+}
+
+/**
+ * Removes the key if it's there. A node with two children is replaced by its
+ * predecessor, which is unlinked from lower down first.
+ */
+template <class Key, class Value>
+void CompactAVLTree<Key, Value>::remove(const Key& key) {
+    uint32_t path[kMaxHeight];
+    int dirs[kMaxHeight];
+    int depth = 0;
+    uint32_t n = root_;
+    while (n != NIL) {
+        const Key& k = at(n).item.first;
+        if (key < k) {
+            dirs[depth] = 0;
+        } else if (k < key) {
+            dirs[depth] = 1;
+        } else {
+            break;
+        }
+        path[depth++] = n;
+        n = dirs[depth - 1] ? right(n) : left(n);
+    }
+    if (n == NIL) {
+        return;
+    }
+
+    if (left(n) != NIL && right(n) != NIL) {
+        int slot = depth;
+        dirs[depth] = 0;
+        path[depth++] = n;
+        uint32_t pred = left(n);
+        while (right(pred) != NIL) {
+            dirs[depth] = 1;
+            path[depth++] = pred;
+            pred = right(pred);
+        }
+        // Unlink pred, then put it where n was. If pred is n's left child
+        // the first step already updated n's left link.
+        replace_link(path, dirs, depth, left(pred));
+        set_left(pred, left(n));
+        set_right(pred, right(n));
+        set_balance(pred, balance(n));
+        replace_link(path, dirs, slot, pred);
+        path[slot] = pred;
+    } else {
+        replace_link(path, dirs, depth, left(n) != NIL ? left(n) : right(n));
+    }
+    release(n);
+    size_--;
+
+    // The subtree the node came out of got shorter
+    for (int i = depth - 1; i >= 0; i--) {
+        uint32_t p = path[i];
+        int b = balance(p) + (dirs[i] ? -1 : 1);
+        if (b == 1 || b == -1) {
+            set_balance(p, b);
+            return;
+        }
+        if (b == 0) {
+            set_balance(p, 0);
+            continue;
+        }
+        uint32_t top = rebalance(p, b);
+        replace_link(path, dirs, i, top);
+        if (balance(top) != 0) {
+            return;
+        }
+    }
+}
+
+/**
+ * Destroys every item and hands the chunks back, in O(n).
+ */
+template <class Key, class Value> void CompactAVLTree<Key, Value>::clear() {
+    if (!std::is_trivially_destructible<CNode>::value && root_ != NIL) {
+        uint32_t stack[kMaxHeight];
+        int depth = 0;
+        stack[depth++] = root_;
+        while (depth > 0) {
+            uint32_t n = stack[--depth];
+            if (left(n) != NIL) {
+                stack[depth++] = left(n);
+            }
+            if (right(n) != NIL) {
+                stack[depth++] = right(n);
+            }
+            at(n).~CNode();
+        }
+    }
+    chunks_.clear();
+    root_ = NIL;
+    next_ = 1;
+    freeList_ = NIL;
+    size_ = 0;
+}
+
+template <class Key, class Value>
+bool CompactAVLTree<Key, Value>::empty() const {
+    return size_ == 0;
+}
+
+template <class Key, class Value>
+std::size_t CompactAVLTree<Key, Value>::size() const {
+    return size_;
+}
+
+/**
+ * Returns the bytes taken by the node pool, free nodes included.
+ */
+template <class Key, class Value>
+std::size_t CompactAVLTree<Key, Value>::memory_used() const {
+    return chunks_.size() * (sizeof(Storage) << kChunkBits) +
+           chunks_.capacity() * sizeof(chunks_[0]);
+}
+
+/**
+ * Checks the AVL property everywhere. Recursion is bounded by the height.
+ */
+template <class Key, class Value>
+bool CompactAVLTree<Key, Value>::isBalanced() const {
+    bool balanced = true;
+    check_height(root_, balanced);
+    return balanced;
+}
+
+template <class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator
+CompactAVLTree<Key, Value>::begin() const {
+    iterator it(this);
+    it.push_leftmost(root_);
+    return it;
+}
+
+template <class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator
+CompactAVLTree<Key, Value>::end() const {
+    return iterator(this);
+}
+
+/**
+ * Returns an iterator to the item with the given key, or end(). The path's
+ * left turns become the iterator's stack.
+ */
+template <class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator
+CompactAVLTree<Key, Value>::find(const Key& key) const {
+    iterator it(this);
+    uint32_t n = root_;
+    while (n != NIL) {
+        const Key& k = at(n).item.first;
+        if (key < k) {
+            it.stack_[it.depth_++] = n;
+            n = left(n);
+        } else if (k < key) {
+            n = right(n);
+        } else {
+            it.stack_[it.depth_++] = n;
+            return it;
+        }
+    }
+    return end();
+}
+
+/**
+ * Throws std::out_of_range if the key isn't there.
+ */
+template <class Key, class Value>
+Value& CompactAVLTree<Key, Value>::operator[](const Key& key) {
+    uint32_t n = find_node(key);
+    if (n == NIL) {
+        throw std::out_of_range("Invalid key");
+    }
+    return at(n).item.second;
+}
+
+template <class Key, class Value>
+Value const& CompactAVLTree<Key, Value>::operator[](const Key& key) const {
+    uint32_t n = find_node(key);
+    if (n == NIL) {
+        throw std::out_of_range("Invalid key");
+    }
+    return at(n).item.second;
+}
+
+template <class Key, class Value>
+typename CompactAVLTree<Key, Value>::CNode&
+CompactAVLTree<Key, Value>::at(uint32_t index) const {
+    Storage* chunk = chunks_[index >> kChunkBits].get();
+    return *reinterpret_cast<CNode*>(
+        &chunk[index & ((uint32_t(1) << kChunkBits) - 1)]);
+}
+
+template <class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::left(uint32_t index) const {
+    return at(index).left;
+}
+
+template <class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::right(uint32_t index) const {
+    return at(index).rightAndBalance & kIndexMask;
+}
+
+template <class Key, class Value>
+int CompactAVLTree<Key, Value>::balance(uint32_t index) const {
+    return static_cast<int>(at(index).rightAndBalance >> kBalanceShift) - 1;
+}
+
+template <class Key, class Value>
+void CompactAVLTree<Key, Value>::set_left(uint32_t index, uint32_t child) {
+    BST_NOTE_WRITE(FIELD_CHILD);
+    at(index).left = child;
+}
+
+template <class Key, class Value>
+void CompactAVLTree<Key, Value>::set_right(uint32_t index, uint32_t child) {
+    BST_NOTE_WRITE(FIELD_CHILD);
+    uint32_t& field = at(index).rightAndBalance;
+    field = (field & ~kIndexMask) | child;
+}
+
+template <class Key, class Value>
+void CompactAVLTree<Key, Value>::set_balance(uint32_t index, int balance) {
+    BST_NOTE_WRITE(FIELD_BALANCE);
+    uint32_t& field = at(index).rightAndBalance;
+    field = (field & kIndexMask) | uint32_t(balance + 1) << kBalanceShift;
+}
+
+template <class Key, class Value>
+void CompactAVLTree<Key, Value>::set_child(uint32_t index, int dir,
+                                           uint32_t child) {
+    if (dir) {
+        set_right(index, child);
+    } else {
+        set_left(index, child);
+    }
+}
+
+// Points the link that the path's first depth steps end at (the root if
+// depth is 0) to child
+template <class Key, class Value>
+void CompactAVLTree<Key, Value>::replace_link(const uint32_t* path,
+                                              const int* dirs, int depth,
+                                              uint32_t child) {
+    if (depth == 0) {
+        root_ = child;
+    } else {
+        set_child(path[depth - 1], dirs[depth - 1], child);
+    }
+}
+
+// Returns the index of a new leaf holding item, reusing a freed node if
+// there is one
+template <class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::allocate(
+    const std::pair<const Key, Value>& item) {
+    uint32_t index;
+    if (freeList_ != NIL) {
+        index = freeList_;
+        freeList_ = at(index).left;
+    } else {
+        if (next_ > kIndexMask) {
+            throw std::length_error("CompactAVLTree is full");
+        }
+        if ((next_ >> kChunkBits) == chunks_.size()) {
+            chunks_.push_back(std::unique_ptr<Storage[]>(
+                new Storage[std::size_t(1) << kChunkBits]));
+        }
+        index = next_++;
+    }
+    new (&at(index)) CNode{item, NIL, uint32_t(1) << kBalanceShift};
+    return index;
+}
+
+// Destroys a node's item and puts it on the free list
+template <class Key, class Value>
+void CompactAVLTree<Key, Value>::release(uint32_t index) {
+    CNode& node = at(index);
+    node.~CNode();
+    // Only the storage is left, so the free list link goes where left was
+    node.left = freeList_;
+    freeList_ = index;
+}
+
+template <class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::find_node(const Key& key) const {
+    uint32_t n = root_;
+    while (n != NIL) {
+        const Key& k = at(n).item.first;
+        if (key < k) {
+            n = left(n);
+        } else if (k < key) {
+            n = right(n);
+        } else {
+            return n;
+        }
+    }
+    return NIL;
+}
+
+// Rotates x's right child up and returns it. Balances are left to the
+// caller.
+template <class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::rotate_left(uint32_t x) {
+    BST_NOTE_ROTATION();
+    uint32_t y = right(x);
+    set_right(x, left(y));
+    set_left(y, x);
+    return y;
+}
+
+template <class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::rotate_right(uint32_t y) {
+    BST_NOTE_ROTATION();
+    uint32_t x = left(y);
+    set_left(y, right(x));
+    set_right(x, y);
+    return x;
+}
+
+// Fixes a node whose balance has reached +-2 with one or two rotations, and
+// returns the subtree's new root with all balances up to date
+template <class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::rebalance(uint32_t node, int b) {
+    int dir = b > 0 ? 1 : -1; // the heavy side
+    uint32_t child = dir > 0 ? right(node) : left(node);
+    int cb = balance(child);
+    if (cb == -dir) {
+        // Zig-zag: the grandchild on the inside comes up two levels
+        uint32_t g = dir > 0 ? left(child) : right(child);
+        int gb = balance(g);
+        if (dir > 0) {
+            set_right(node, rotate_right(child));
+            rotate_left(node);
+        } else {
+            set_left(node, rotate_left(child));
+            rotate_right(node);
+        }
+        set_balance(node, gb == dir ? -dir : 0);
+        set_balance(child, gb == -dir ? dir : 0);
+        set_balance(g, 0);
+        return g;
+    }
+    uint32_t top = dir > 0 ? rotate_left(node) : rotate_right(node);
+    if (cb == 0) {
+        // Only after a removal: the height stays the same
+        set_balance(node, dir);
+        set_balance(child, -dir);
+    } else {
+        set_balance(node, 0);
+        set_balance(child, 0);
+    }
+    return top;
+}
+
+// Returns the height of the subtree at node, clearing balanced if any stored
+// balance is wrong or out of range
+template <class Key, class Value>
+int CompactAVLTree<Key, Value>::check_height(uint32_t node,
+                                             bool& balanced) const {
+    if (node == NIL) {
+        return 0;
+    }
+    int l = check_height(left(node), balanced);
+    int r = check_height(right(node), balanced);
+    if (r - l != balance(node) || r - l > 1 || l - r > 1) {
+        balanced = false;
+    }
+    return (l > r ? l : r) + 1;
+}
+
+/*
+  ---------------------------------------------------------------
+  Begin implementations for the CompactAVLTree::iterator class.
+  ---------------------------------------------------------------
+*/
+
+template <class Key, class Value>
+CompactAVLTree<Key, Value>::iterator::iterator() : tree_(nullptr), depth_(0) {}
+
+template <class Key, class Value>
+CompactAVLTree<Key, Value>::iterator::iterator(
+    const CompactAVLTree<Key, Value>* tree)
+    : tree_(tree), depth_(0) {}
+
+template <class Key, class Value>
+std::pair<const Key, Value>&
+CompactAVLTree<Key, Value>::iterator::operator*() const {
+    return tree_->at(current()).item;
+}
+
+template <class Key, class Value>
+std::pair<const Key, Value>*
+CompactAVLTree<Key, Value>::iterator::operator->() const {
+    return &tree_->at(current()).item;
+}
+
+template <class Key, class Value>
+bool CompactAVLTree<Key, Value>::iterator::operator==(
+    const iterator& rhs) const {
+    return current() == rhs.current();
+}
+
+template <class Key, class Value>
+bool CompactAVLTree<Key, Value>::iterator::operator!=(
+    const iterator& rhs) const {
+    return current() != rhs.current();
+}
+
+/**
+ * Pops the current node and, if it has a right subtree, pushes the way down
+ * to that subtree's smallest node.
+ */
+template <class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator&
+CompactAVLTree<Key, Value>::iterator::operator++() {
+    uint32_t n = stack_[--depth_];
+    push_leftmost(tree_->right(n));
+    return *this;
+}
+
+template <class Key, class Value>
+void CompactAVLTree<Key, Value>::iterator::push_leftmost(uint32_t node) {
+    while (node != NIL) {
+        stack_[depth_++] = node;
+        node = tree_->left(node);
+    }
+}
+
+// Returns the index of the current node, or NIL at the end
+template <class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::iterator::current() const {
+    return depth_ == 0 ? NIL : stack_[depth_ - 1];
+}
+
+#endif
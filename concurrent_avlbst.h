@@ -0,0 +1,304 @@
+#ifndef CONCURRENT_AVLBST_H
+#define CONCURRENT_AVLBST_H
+
+#include "avlbst.h"
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * An AVL tree that can be shared between threads, where lookups and
+ * iteration never block and never wait for writers.
+ *
+ * It keeps two copies of the tree (Left-Right concurrency control). Readers
+ * always go to the copy that is currently published. A writer changes the
+ * other copy, publishes it, waits for the readers still on the old copy to
+ * leave, and then makes the same change there. Writers are serialized with
+ * a mutex, and each copy is an ordinary AVLTree, so insert and remove keep
+ * their usual balancing.
+ *
+ * The price is twice the memory and doing every write twice. Reads only
+ * touch a counter on the way in and out, which is spread over several cache
+ * lines so that threads rarely share one.
+ */
+template <class Key, class Value> class ConcurrentAVLTree {
+  public:
+    // What read and write hand to their callbacks. It keeps subtree sizes,
+    // so that size() needn't count the nodes while holding up writers.
+    typedef AVLTree<Key, Value, std::less<Key>, true> Tree;
+
+    ConcurrentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& new_item);
+    void remove(const Key& key);
+    void clear();
+
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    Value at(const Key& key) const;
+    std::size_t size() const;
+    bool empty() const;
+
+    template <typename F>
+    auto read(F f) const
+        -> decltype(f(std::declval<const Tree&>()));
+    template <typename F> void write(F f);
+
+  private:
+    // Per-copy count of readers, split into stripes by thread
+    struct ReadIndicator {
+        static const std::size_t kStripes = 32;
+        struct alignas(64) Stripe {
+            std::atomic<long> readers;
+        };
+
+        ReadIndicator();
+        void arrive(std::size_t stripe);
+        void depart(std::size_t stripe);
+        bool empty() const;
+
+        Stripe stripes_[kStripes];
+    };
+
+    // Marks a reader as being inside the copy it was given until destroyed
+    class ReadGuard {
+      public:
+        explicit ReadGuard(const ConcurrentAVLTree<Key, Value>& owner);
+        ~ReadGuard();
+        const Tree& tree() const;
+
+      private:
+        ReadGuard(const ReadGuard&);
+        ReadGuard& operator=(const ReadGuard&);
+
+        const ConcurrentAVLTree<Key, Value>& owner_;
+        int version_;
+        std::size_t stripe_;
+    };
+
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+    static std::size_t stripe_of_this_thread();
+    void toggle_version_and_wait();
+    void copy_published(int stale);
+
+    Tree trees_[2];
+    std::atomic<int> published_; // the copy readers should use
+    std::atomic<int> version_;   // the read indicator new readers arrive at
+    mutable ReadIndicator indicators_[2];
+    std::mutex writeLock_;
+};
+
+/*
+  ---------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  ---------------------------------------------------------
+*/
+
+template <class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ReadIndicator::ReadIndicator() {
+    for (std::size_t i = 0; i < kStripes; i++) {
+        stripes_[i].readers.store(0);
+    }
+}
+
+template <class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::ReadIndicator::arrive(std::size_t stripe) {
+    stripes_[stripe].readers.fetch_add(1);
+}
+
+template <class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::ReadIndicator::depart(std::size_t stripe) {
+    stripes_[stripe].readers.fetch_sub(1);
+}
+
+template <class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::ReadIndicator::empty() const {
+    for (std::size_t i = 0; i < kStripes; i++) {
+        if (stripes_[i].readers.load() != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Arrives at the current version's indicator before looking at which copy
+ * is published. A writer only touches a copy after both indicators have
+ * been seen empty since it was unpublished, so the copy this reader picks
+ * stays untouched until the guard is destroyed.
+ */
+template <class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ReadGuard::ReadGuard(
+    const ConcurrentAVLTree<Key, Value>& owner)
+    : owner_(owner), version_(owner.version_.load()),
+      stripe_(stripe_of_this_thread()) {
+    owner_.indicators_[version_].arrive(stripe_);
+}
+
+template <class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ReadGuard::~ReadGuard() {
+    owner_.indicators_[version_].depart(stripe_);
+}
+
+template <class Key, class Value>
+const typename ConcurrentAVLTree<Key, Value>::Tree&
+ConcurrentAVLTree<Key, Value>::ReadGuard::tree() const {
+    return owner_.trees_[owner_.published_.load()];
+}
+
+template <class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ConcurrentAVLTree()
+    : published_(0), version_(0) {}
+
+/**
+ * Inserts or overwrites an item. Blocks other writers, never readers.
+ */
+template <class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::insert(
+    const std::pair<const Key, Value>& new_item) {
+    write([&](Tree& tree) { tree.insert(new_item); });
+}
+
+template <class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::remove(const Key& key) {
+    write([&](Tree& tree) { tree.remove(key); });
+}
+
+template <class Key, class Value> void ConcurrentAVLTree<Key, Value>::clear() {
+    write([](Tree& tree) { tree.clear(); });
+}
+
+/**
+ * Copies the value for key into value and returns true, or returns false if
+ * the key isn't there. Never blocks.
+ */
+template <class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::find(const Key& key, Value& value) const {
+    ReadGuard guard(*this);
+    typename Tree::iterator it = guard.tree().find(key);
+    if (it == guard.tree().end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template <class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::contains(const Key& key) const {
+    ReadGuard guard(*this);
+    return guard.tree().find(key) != guard.tree().end();
+}
+
+/**
+ * Returns a copy of the value for key. Like operator[] on the other trees,
+ * throws std::out_of_range if the key isn't there.
+ */
+template <class Key, class Value>
+Value ConcurrentAVLTree<Key, Value>::at(const Key& key) const {
+    ReadGuard guard(*this);
+    return guard.tree()[key];
+}
+
+template <class Key, class Value>
+std::size_t ConcurrentAVLTree<Key, Value>::size() const {
+    ReadGuard guard(*this);
+    return guard.tree().size();
+}
+
+template <class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::empty() const {
+    ReadGuard guard(*this);
+    return guard.tree().empty();
+}
+
+/**
+ * Calls f with a consistent snapshot of the tree and returns what it
+ * returns. This is how to iterate: the snapshot doesn't change while f runs,
+ * but f must not keep iterators or references after it returns. Writers that
+ * come along meanwhile wait for f before their second copy, so keep f short.
+ */
+template <class Key, class Value>
+template <typename F>
+auto ConcurrentAVLTree<Key, Value>::read(F f) const
+    -> decltype(f(std::declval<const Tree&>())) {
+    ReadGuard guard(*this);
+    return f(guard.tree());
+}
+
+/**
+ * Applies f, which must change a Tree deterministically, to both copies.
+ * f is called twice, so it must not have other side effects. If it throws on
+ * the first copy, nothing has been published and the exception propagates.
+ * If it throws on the second, e.g. std::bad_alloc, the change is already
+ * visible, so the write stands: that copy is made over from the published
+ * one instead, and the exception goes no further.
+ */
+template <class Key, class Value>
+template <typename F>
+void ConcurrentAVLTree<Key, Value>::write(F f) {
+    std::lock_guard<std::mutex> lock(writeLock_);
+    int published = published_.load();
+    f(trees_[1 - published]);
+    published_.store(1 - published);
+    toggle_version_and_wait();
+    try {
+        f(trees_[published]);
+    } catch (...) {
+        copy_published(published);
+    }
+}
+
+// Replaces the items of trees_[stale], which no reader can be using, with
+// those of the published copy, after a write failed on it part way. If that
+// fails too, the copies could only go on being different, with readers
+// seeing one or the other at random, so it gives up on the program instead.
+template <class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::copy_published(int stale) {
+    try {
+        const Tree& published = trees_[1 - stale];
+        std::vector<std::pair<Key, Value> > items;
+        items.reserve(published.size());
+        for (typename Tree::iterator it = published.begin();
+             it != published.end(); ++it) {
+            items.push_back(*it);
+        }
+        trees_[stale].build_from_sorted(items.begin(), items.end());
+    } catch (...) {
+        std::terminate();
+    }
+}
+
+// Spreads threads over the read indicator stripes
+template <class Key, class Value>
+std::size_t ConcurrentAVLTree<Key, Value>::stripe_of_this_thread() {
+    static thread_local std::size_t stripe =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) %
+        ReadIndicator::kStripes;
+    return stripe;
+}
+
+// Waits until every reader that might still see the unpublished copy has
+// left. New readers are sent to the other indicator first, so that the one
+// being drained can't be kept busy forever.
+template <class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::toggle_version_and_wait() {
+    int previous = version_.load();
+    int next = 1 - previous;
+    while (!indicators_[next].empty()) {
+        std::this_thread::yield();
+    }
+    version_.store(next);
+    while (!indicators_[previous].empty()) {
+        std::this_thread::yield();
+    }
+}
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef FROZEN_BST_H
+#define FROZEN_BST_H
+
+#include "bst.h"
+#include "node_alloc.h"
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * A read-only copy of a search tree, laid out as an array in Eytzinger
+ * (breadth-first) order: the root is in slot 1 and the children of slot k
+ * are in slots 2k and 2k + 1. There are no pointers, the top levels that
+ * every search goes through share a few cache lines, and the slots a search
+ * may visit a few levels down are next to each other, so they can be
+ * prefetched before it is known which one it needs.
+ *
+ * Lookups and iteration work like on the tree it was made from, except that
+ * the items can't be changed. Keys are kept twice, densely packed for
+ * searching and next to their values for iteration.
+ */
+template <class Key, class Value> class FrozenTree {
+  public:
+    FrozenTree();
+    explicit FrozenTree(const BinarySearchTree<Key, Value>& tree);
+
+    /**
+     * Visits the items in key order.
+     */
+    class iterator {
+      public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+      private:
+        friend class FrozenTree<Key, Value>;
+        iterator(const FrozenTree<Key, Value>* tree, std::size_t slot);
+
+        const FrozenTree<Key, Value>* tree_;
+        std::size_t slot_; // 0 at the end
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value const& operator[](const Key& key) const;
+    bool empty() const;
+    std::size_t size() const;
+
+  private:
+    std::size_t fill(std::size_t slot, std::size_t rank,
+                     const std::vector<const std::pair<const Key, Value>*>&
+                         sorted,
+                     std::vector<std::size_t>& ranks);
+    std::size_t lower_bound_slot(const Key& key) const;
+    static std::size_t trailing_ones(std::size_t k);
+
+    // keys_[k] is the key in slot k. Slot 0 is unused. Starting on a cache
+    // line, the slots of each group of descendants do too.
+    std::vector<Key, CacheAlignedAllocator<Key> > keys_;
+    // items_[k - 1] is the item in slot k
+    std::vector<std::pair<const Key, Value> > items_;
+};
+
+template <class Key, class Value>
+FrozenTree<Key, Value> freeze(const BinarySearchTree<Key, Value>& tree);
+
+/*
+  --------------------------------------------------
+  Begin implementations for the FrozenTree class.
+  --------------------------------------------------
+*/
+
+template <class Key, class Value> FrozenTree<Key, Value>::FrozenTree() {}
+
+/**
+ * Copies the items of tree, which works for AVL trees too. Takes O(n).
+ */
+template <class Key, class Value>
+FrozenTree<Key, Value>::FrozenTree(const BinarySearchTree<Key, Value>& tree) {
+    std::vector<const std::pair<const Key, Value>*> sorted;
+    sorted.reserve(tree.size());
+    for (typename BinarySearchTree<Key, Value>::iterator it = tree.begin();
+         it != tree.end(); ++it) {
+        sorted.push_back(&*it);
+    }
+
+    // Work out which item goes in each slot, then copy them in slot order
+    std::vector<std::size_t> ranks(sorted.size() + 1);
+    fill(1, 0, sorted, ranks);
+    keys_.reserve(sorted.size() + 1);
+    keys_.push_back(Key());
+    items_.reserve(sorted.size());
+    for (std::size_t k = 1; k <= sorted.size(); k++) {
+        keys_.push_back(sorted[ranks[k]]->first);
+        items_.push_back(*sorted[ranks[k]]);
+    }
+}
+
+/**
+ * Returns a FrozenTree with the items of tree.
+ */
+template <class Key, class Value>
+FrozenTree<Key, Value> freeze(const BinarySearchTree<Key, Value>& tree) {
+    return FrozenTree<Key, Value>(tree);
+}
+
+template <class Key, class Value>
+typename FrozenTree<Key, Value>::iterator FrozenTree<Key, Value>::begin() const {
+    // The smallest key is in the leftmost slot
+    std::size_t slot = 1;
+    while (2 * slot <= items_.size()) {
+        slot *= 2;
+    }
+    return iterator(this, items_.empty() ? 0 : slot);
+}
+
+template <class Key, class Value>
+typename FrozenTree<Key, Value>::iterator FrozenTree<Key, Value>::end() const {
+    return iterator(this, 0);
+}
+
+/**
+ * Returns an iterator to the item with the given key, or end().
+ */
+template <class Key, class Value>
+typename FrozenTree<Key, Value>::iterator
+FrozenTree<Key, Value>::find(const Key& key) const {
+    std::size_t slot = lower_bound_slot(key);
+    if (slot == 0 || key < keys_[slot]) {
+        return end();
+    }
+    return iterator(this, slot);
+}
+
+/**
+ * Returns an iterator to the first item whose key is not less than key.
+ */
+template <class Key, class Value>
+typename FrozenTree<Key, Value>::iterator
+FrozenTree<Key, Value>::lower_bound(const Key& key) const {
+    return iterator(this, lower_bound_slot(key));
+}
+
+/**
+ * Throws std::out_of_range if the key isn't there.
+ */
+template <class Key, class Value>
+Value const& FrozenTree<Key, Value>::operator[](const Key& key) const {
+    iterator it = find(key);
+    if (it == end()) {
+        throw std::out_of_range("Invalid key");
+    }
+    return it->second;
+}
+
+template <class Key, class Value> bool FrozenTree<Key, Value>::empty() const {
+    return items_.empty();
+}
+
+template <class Key, class Value>
+std::size_t FrozenTree<Key, Value>::size() const {
+    return items_.size();
+}
+
+// Assigns ranks to the subtree of slots under slot by an in-order walk,
+// starting from rank. Returns the next unused rank. The recursion is only as
+// deep as the array's implicit tree, which is perfectly balanced.
+template <class Key, class Value>
+std::size_t FrozenTree<Key, Value>::fill(
+    std::size_t slot, std::size_t rank,
+    const std::vector<const std::pair<const Key, Value>*>& sorted,
+    std::vector<std::size_t>& ranks) {
+    if (slot > sorted.size()) {
+        return rank;
+    }
+    rank = fill(2 * slot, rank, sorted, ranks);
+    ranks[slot] = rank++;
+    return fill(2 * slot + 1, rank, sorted, ranks);
+}
+
+// Returns the slot of the first key not less than key, or 0 if there's none.
+// The descent has no branches to mispredict: each step goes to the left or
+// right child depending on a comparison. Meanwhile the block of descendants
+// a few levels further down, which all share a cache line, is prefetched,
+// as long as the tree goes that deep.
+template <class Key, class Value>
+std::size_t FrozenTree<Key, Value>::lower_bound_slot(const Key& key) const {
+    const std::size_t n = items_.size();
+    const Key* keys = keys_.data();
+    // Descendants that many levels down fit in one cache line
+    const std::size_t lookahead =
+        sizeof(Key) >= 64 ? 1 : 64 / sizeof(Key);
+    std::size_t k = 1;
+    while (k <= n) {
+#if defined(__GNUC__)
+        if (k * lookahead <= n) {
+            __builtin_prefetch(keys + k * lookahead);
+        }
+#endif
+        k = 2 * k + (keys[k] < key);
+    }
+    // The path ends with a right turn for every step past the answer, then
+    // the left turn at the answer itself. Undo those.
+    return k >> (trailing_ones(k) + 1);
+}
+
+template <class Key, class Value>
+std::size_t FrozenTree<Key, Value>::trailing_ones(std::size_t k) {
+#if defined(__GNUC__)
+    return ~k == 0 ? sizeof(k) * 8 : __builtin_ctzll(~k);
+#else
+    std::size_t count = 0;
+    while (k & 1) {
+        k >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+/*
+  ---------------------------------------------------------
+  Begin implementations for the FrozenTree::iterator class.
+  ---------------------------------------------------------
+*/
+
+template <class Key, class Value>
+FrozenTree<Key, Value>::iterator::iterator() : tree_(nullptr), slot_(0) {}
+
+template <class Key, class Value>
+FrozenTree<Key, Value>::iterator::iterator(const FrozenTree<Key, Value>* tree,
+                                           std::size_t slot)
+    : tree_(tree), slot_(slot) {}
+
+template <class Key, class Value>
+const std::pair<const Key, Value>&
+FrozenTree<Key, Value>::iterator::operator*() const {
+    return tree_->items_[slot_ - 1];
+}
+
+template <class Key, class Value>
+const std::pair<const Key, Value>*
+FrozenTree<Key, Value>::iterator::operator->() const {
+    return &tree_->items_[slot_ - 1];
+}
+
+template <class Key, class Value>
+bool FrozenTree<Key, Value>::iterator::operator==(const iterator& rhs) const {
+    return slot_ == rhs.slot_;
+}
+
+template <class Key, class Value>
+bool FrozenTree<Key, Value>::iterator::operator!=(const iterator& rhs) const {
+    return slot_ != rhs.slot_;
+}
+
+/**
+ * Moves to the in-order successor: the leftmost slot of the right subtree if
+ * there is one, and otherwise the closest ancestor we're on the left of.
+ */
+template <class Key, class Value>
+typename FrozenTree<Key, Value>::iterator&
+FrozenTree<Key, Value>::iterator::operator++() {
+    std::size_t n = tree_->items_.size();
+    if (2 * slot_ + 1 <= n) {
+        slot_ = 2 * slot_ + 1;
+        while (2 * slot_ <= n) {
+            slot_ *= 2;
+        }
+    } else {
+        slot_ >>= trailing_ones(slot_) + 1;
+    }
+    return *this;
+}
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef NODE_ALLOC_H
+#define NODE_ALLOC_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * The interface a search tree uses to get memory for its nodes. Trees only
+ * ever hand back blocks they got from the same allocator, so two trees that
+ * exchange nodes must share one.
+ */
+class NodeAllocator {
+  public:
+    virtual ~NodeAllocator() {}
+
+    // Returns uninitialized memory for one node of the given size.
+    virtual void* allocate(std::size_t size) = 0;
+    // Returns a block previously handed out by allocate().
+    virtual void deallocate(void* block) = 0;
+    // Frees every outstanding block at once. Returns false if the allocator
+    // can't do that, in which case nothing was freed.
+    virtual bool release() = 0;
+    // Whether allocate() and deallocate() may be called from several threads
+    // at once.
+    virtual bool thread_safe() const { return false; }
+};
+
+/**
+ * Allocates every node separately with operator new. This is the default, and
+ * a single instance is shared by every tree that doesn't ask for anything
+ * else.
+ */
+class HeapNodeAllocator : public NodeAllocator {
+  public:
+    static std::shared_ptr<NodeAllocator> instance();
+
+    virtual void* allocate(std::size_t size);
+    virtual void deallocate(void* block);
+    virtual bool release();
+    virtual bool thread_safe() const;
+};
+
+/**
+ * A slab allocator for nodes of a single size. Blocks are carved out of large
+ * chunks, and freed blocks go onto a free list to be reused by the next
+ * allocation. Since it owns all of the chunks, release() can hand them all
+ * back without touching the individual nodes.
+ *
+ * Not thread-safe.
+ */
+class PoolNodeAllocator : public NodeAllocator {
+  public:
+    explicit PoolNodeAllocator(std::size_t blocksPerChunk = 4096);
+    virtual ~PoolNodeAllocator();
+
+    virtual void* allocate(std::size_t size);
+    virtual void deallocate(void* block);
+    virtual bool release();
+
+  private:
+    // Unused blocks store the next pointer of the free list in place.
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    PoolNodeAllocator(const PoolNodeAllocator&);
+    PoolNodeAllocator& operator=(const PoolNodeAllocator&);
+
+    std::size_t blocksPerChunk_;
+    std::size_t blockSize_; // 0 until the first allocation
+    std::vector<char*> chunks_;
+    char* next_; // next never-used block in the newest chunk
+    char* end_;  // end of the newest chunk
+    FreeBlock* free_;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the HeapNodeAllocator class.
+  -----------------------------------------------------
+*/
+
+/**
+ * Returns the shared heap allocator.
+ */
+inline std::shared_ptr<NodeAllocator> HeapNodeAllocator::instance() {
+    static std::shared_ptr<NodeAllocator> heap(new HeapNodeAllocator());
+    return heap;
+}
+
+inline void* HeapNodeAllocator::allocate(std::size_t size) {
+    return ::operator new(size);
+}
+
+inline void HeapNodeAllocator::deallocate(void* block) {
+    ::operator delete(block);
+}
+
+/**
+ * The heap doesn't know which blocks belong to which tree, so the caller has
+ * to free them one at a time.
+ */
+inline bool HeapNodeAllocator::release() { return false; }
+
+inline bool HeapNodeAllocator::thread_safe() const { return true; }
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the PoolNodeAllocator class.
+  -----------------------------------------------------
+*/
+
+inline PoolNodeAllocator::PoolNodeAllocator(std::size_t blocksPerChunk)
+    : blocksPerChunk_(blocksPerChunk == 0 ? 1 : blocksPerChunk),
+      blockSize_(0), next_(nullptr), end_(nullptr), free_(nullptr) {}
+
+inline PoolNodeAllocator::~PoolNodeAllocator() { release(); }
+
+/**
+ * The first allocation fixes the block size. A pool can be shared by several
+ * trees as long as they all use the same kind of node.
+ */
+inline void* PoolNodeAllocator::allocate(std::size_t size) {
+    if (blockSize_ == 0) {
+        const std::size_t align = alignof(std::max_align_t);
+        if (size < sizeof(FreeBlock)) {
+            size = sizeof(FreeBlock);
+        }
+        blockSize_ = (size + align - 1) / align * align;
+    } else if (size > blockSize_) {
+        throw std::invalid_argument("Node too large for this pool");
+    }
+    if (free_ != nullptr) {
+        FreeBlock* block = free_;
+        free_ = block->next;
+        return block;
+    }
+    if (next_ == end_) {
+        char* chunk =
+            static_cast<char*>(::operator new(blockSize_ * blocksPerChunk_));
+        chunks_.push_back(chunk);
+        next_ = chunk;
+        end_ = chunk + blockSize_ * blocksPerChunk_;
+    }
+    void* block = next_;
+    next_ += blockSize_;
+    return block;
+}
+
+inline void PoolNodeAllocator::deallocate(void* block) {
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = free_;
+    free_ = freed;
+}
+
+/**
+ * Frees all of the chunks, which invalidates every block handed out so far.
+ */
+inline bool PoolNodeAllocator::release() {
+    for (std::size_t i = 0; i < chunks_.size(); i++) {
+        ::operator delete(chunks_[i]);
+    }
+    chunks_.clear();
+    next_ = end_ = nullptr;
+    free_ = nullptr;
+    return true;
+}
+
+/**
+ * A standard allocator whose blocks start on a cache line boundary, for the
+ * arrays of the read-only layouts (FrozenTree, StaticBTree), which rely on
+ * groups of keys sharing a line.
+ */
+template <typename T> class CacheAlignedAllocator {
+  public:
+    typedef T value_type;
+    static const std::size_t alignment = 64;
+
+    CacheAlignedAllocator() {}
+    template <typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(
+            ::operator new(n * sizeof(T), std::align_val_t(alignment)));
+    }
+    void deallocate(T* block, std::size_t) {
+        ::operator delete(block, std::align_val_t(alignment));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const CacheAlignedAllocator<T>&,
+                const CacheAlignedAllocator<U>&) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const CacheAlignedAllocator<T>&,
+                const CacheAlignedAllocator<U>&) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef NODE_WRITES_H
+#define NODE_WRITES_H
+
+/*
+ * Optional accounting of how much the trees write to their nodes, for
+ * comparing engines (see bst-bench writes). Build with -DBST_COUNT_WRITES and
+ * every store to a node goes through BST_NOTE_WRITE(field), which adds one to
+ * node_writes() and to node_writes(field), so engines that keep different
+ * fields can be compared field by field. Filling in a brand new node doesn't
+ * count, since every engine has to do that. Likewise every single rotation
+ * goes through BST_NOTE_ROTATION() and adds one to rotations(); a double
+ * rotation counts as two. Without the flag the macros are empty and cost
+ * nothing.
+ */
+
+// The kinds of node field a store can go to
+enum NodeField {
+    FIELD_CHILD,   // left or right link
+    FIELD_PARENT,  // parent link
+    FIELD_SIZE,    // subtree size
+    FIELD_BALANCE, // AVL balance or red-black color
+    NODE_FIELDS
+};
+
+#ifdef BST_COUNT_WRITES
+
+inline unsigned long long& node_writes() {
+    static unsigned long long count = 0;
+    return count;
+}
+
+inline unsigned long long& node_writes(NodeField field) {
+    static unsigned long long counts[NODE_FIELDS] = {};
+    return counts[field];
+}
+
+inline unsigned long long& rotations() {
+    static unsigned long long count = 0;
+    return count;
+}
+
+#define BST_NOTE_WRITE(field) (++node_writes(), ++node_writes(field))
+#define BST_NOTE_ROTATION() (++rotations())
+
+#else
+
+#define BST_NOTE_WRITE(field) ((void)0)
+#define BST_NOTE_ROTATION() ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,466 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include "bst.h"
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * A node for a red-black tree, which adds its color to the plain node.
+ */
+template <typename Key, typename Value>
+class RBNode : public Node<Key, Value> {
+  public:
+    RBNode(ItemMaker<Key, Value>& maker, RBNode<Key, Value>* parent);
+    ~RBNode() = default;
+
+    bool isRed() const;
+    void setRed(bool red);
+
+    // These hide the Node versions, like the AVLNode ones do.
+    RBNode<Key, Value>* getParent() const;
+    RBNode<Key, Value>* getLeft() const;
+    RBNode<Key, Value>* getRight() const;
+
+  protected:
+    bool red_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------------
+*/
+
+/**
+ * Constructs a node whose item is built in place by maker. New nodes start
+ * out red, since that keeps the number of black nodes on every path the same.
+ */
+template <class Key, class Value>
+RBNode<Key, Value>::RBNode(ItemMaker<Key, Value>& maker,
+                           RBNode<Key, Value>* parent)
+    : Node<Key, Value>(maker, parent), red_(true) {}
+
+/**
+ * Whether the node is red. Missing children count as black.
+ */
+template <class Key, class Value> bool RBNode<Key, Value>::isRed() const {
+    return red_;
+}
+
+template <class Key, class Value> void RBNode<Key, Value>::setRed(bool red) {
+    BST_NOTE_WRITE(FIELD_BALANCE);
+    red_ = red;
+}
+
+template <class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getParent() const {
+    return static_cast<RBNode<Key, Value>*>(this->parent_);
+}
+
+template <class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getLeft() const {
+    return static_cast<RBNode<Key, Value>*>(this->left_);
+}
+
+template <class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getRight() const {
+    return static_cast<RBNode<Key, Value>*>(this->right_);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------------
+*/
+
+/**
+ * A red-black tree: no red node has a red child, and every path from a node
+ * down to a missing child passes the same number of black nodes. That keeps
+ * the height within 2 log2(n + 1), looser than an AVL tree's 1.44 log2(n),
+ * but an insert needs at most two rotations and a removal at most three,
+ * where an AVL removal may rotate at every level. Recoloring may go on up
+ * the tree, but is O(1) amortized per update. That suits tables that are
+ * written more than they are read.
+ *
+ * It has the same interface as BinarySearchTree, hinted inserts and finger
+ * searches included.
+ */
+template <class Key, class Value, class Compare = std::less<Key> >
+class RBTree : public BinarySearchTree<Key, Value, Compare> {
+  public:
+    RBTree();
+    explicit RBTree(const Compare& comp);
+    virtual void remove(const Key& key);
+    virtual bool isBalanced() const;
+
+  protected:
+    virtual void nodeSwap(RBNode<Key, Value>* n1, RBNode<Key, Value>* n2);
+    virtual Node<Key, Value>* insert_item(ItemMaker<Key, Value>& maker,
+                                          Node<Key, Value>* hint,
+                                          bool& inserted);
+    virtual void build_fix(Node<Key, Value>* node, std::size_t leftSize,
+                           std::size_t rightSize);
+
+  private:
+    static bool is_red(RBNode<Key, Value>* node);
+    void insert_fix(RBNode<Key, Value>* n);
+    void remove_fix(RBNode<Key, Value>* n, RBNode<Key, Value>* p, bool left);
+    void rotate_right(RBNode<Key, Value>* y);
+    void rotate_left(RBNode<Key, Value>* x);
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the RBTree class.
+  -----------------------------------------------
+*/
+
+template <class Key, class Value, class Compare>
+RBTree<Key, Value, Compare>::RBTree() {
+    this->template use_nodes<RBNode<Key, Value> >();
+}
+
+/**
+ * Constructs an empty tree ordered by a copy of comp.
+ */
+template <class Key, class Value, class Compare>
+RBTree<Key, Value, Compare>::RBTree(const Compare& comp)
+    : BinarySearchTree<Key, Value, Compare>(comp) {
+    this->template use_nodes<RBNode<Key, Value> >();
+}
+
+/**
+ * Every insertion, including the emplace family, goes through here.
+ */
+template <class Key, class Value, class Compare>
+Node<Key, Value>* RBTree<Key, Value, Compare>::insert_item(
+    ItemMaker<Key, Value>& maker, Node<Key, Value>* hint, bool& inserted) {
+    if (this->root_ == nullptr) {
+        RBNode<Key, Value>* n =
+            static_cast<RBNode<Key, Value>*>(this->create_node(maker, nullptr));
+        n->setRed(false);
+        this->root_ = n;
+        inserted = true;
+        this->finger_ = n;
+        return n;
+    }
+    Node<Key, Value>* parent;
+    bool left;
+    Node<Key, Value>* found = this->find_slot(
+        maker.key(), this->insert_start(maker.key(), hint), parent, left);
+    if (found != nullptr) {
+        maker.found(found->getValue());
+        inserted = false;
+        this->finger_ = found;
+        return found;
+    }
+
+    RBNode<Key, Value>* n =
+        static_cast<RBNode<Key, Value>*>(this->create_node(maker, parent));
+    if (left) {
+        parent->setLeft(n);
+    } else {
+        parent->setRight(n);
+    }
+    insert_fix(n);
+    inserted = true;
+    this->finger_ = n;
+    return n;
+}
+
+// Restores the red-black rules after the red node n was linked in. If n's
+// parent is red too, either both it and n's uncle are red, and turn black
+// while the grandparent turns red (which may repeat higher up), or one or
+// two rotations settle it for good.
+template <class Key, class Value, class Compare>
+void RBTree<Key, Value, Compare>::insert_fix(RBNode<Key, Value>* n) {
+    while (true) {
+        RBNode<Key, Value>* p = n->getParent();
+        if (p == nullptr) {
+            // n is the root
+            n->setRed(false);
+            return;
+        }
+        if (!p->isRed()) {
+            return;
+        }
+        // p is red, so it isn't the root
+        RBNode<Key, Value>* g = p->getParent();
+        bool pLeft = p == g->getLeft();
+        RBNode<Key, Value>* u = pLeft ? g->getRight() : g->getLeft();
+        if (is_red(u)) {
+            p->setRed(false);
+            u->setRed(false);
+            g->setRed(true);
+            n = g;
+            continue;
+        }
+        if (pLeft) {
+            if (n == p->getRight()) {
+                // zig-zag
+                rotate_left(p);
+                p = n;
+            }
+            rotate_right(g);
+        } else {
+            if (n == p->getLeft()) {
+                // zig-zag
+                rotate_right(p);
+                p = n;
+            }
+            rotate_left(g);
+        }
+        p->setRed(false);
+        g->setRed(true);
+        return;
+    }
+}
+
+/*
+ * Like the other trees, a node with two children is swapped with its
+ * predecessor first, so the node taken out has at most one child.
+ */
+template <class Key, class Value, class Compare>
+void RBTree<Key, Value, Compare>::remove(const Key& key) {
+    RBNode<Key, Value>* n =
+        static_cast<RBNode<Key, Value>*>(this->internalFind(key));
+    if (n == nullptr) {
+        return;
+    }
+    if (n->getLeft() != nullptr && n->getRight() != nullptr) {
+        // n has two children
+        nodeSwap(n, static_cast<RBNode<Key, Value>*>(this->predecessor(n)));
+    }
+    RBNode<Key, Value>* p = n->getParent();
+    RBNode<Key, Value>* c = n->getLeft();
+    if (c == nullptr) {
+        c = n->getRight();
+    }
+    bool left = p != nullptr && n == p->getLeft();
+    bool wasRed = n->isRed();
+
+    if (n == this->finger_) {
+        this->finger_ = nullptr;
+    }
+    this->destroy_node(n);
+    // Fix pointers
+    if (p == nullptr) {
+        // n was root node
+        this->root_ = c;
+    } else if (left) {
+        p->setLeft(c);
+    } else {
+        p->setRight(c);
+    }
+    if (c != nullptr) {
+        c->setParent(p);
+    }
+
+    // Taking out a red node changes no black counts. A black one with a
+    // child leaves a red child, which can simply turn black.
+    if (wasRed) {
+        return;
+    }
+    if (c != nullptr) {
+        c->setRed(false);
+        return;
+    }
+    remove_fix(nullptr, p, left);
+}
+
+// The subtree at n, on the left or right of p, has one black node fewer on
+// its paths than its sibling's. Borrows from the sibling: by recoloring if
+// the sibling and its children are black, which moves the shortage up to p,
+// or with at most three rotations in all otherwise.
+template <class Key, class Value, class Compare>
+void RBTree<Key, Value, Compare>::remove_fix(RBNode<Key, Value>* n,
+                                             RBNode<Key, Value>* p,
+                                             bool left) {
+    while (p != nullptr && !is_red(n)) {
+        RBNode<Key, Value>* s = left ? p->getRight() : p->getLeft();
+        if (s->isRed()) {
+            // Make the sibling black, so the cases below apply
+            s->setRed(false);
+            p->setRed(true);
+            if (left) {
+                rotate_left(p);
+            } else {
+                rotate_right(p);
+            }
+            s = left ? p->getRight() : p->getLeft();
+        }
+        RBNode<Key, Value>* near = left ? s->getLeft() : s->getRight();
+        RBNode<Key, Value>* far = left ? s->getRight() : s->getLeft();
+        if (!is_red(near) && !is_red(far)) {
+            s->setRed(true);
+            n = p;
+            p = n->getParent();
+            left = p != nullptr && n == p->getLeft();
+            continue;
+        }
+        if (!is_red(far)) {
+            // zig-zag: turn the red nephew into the far one
+            near->setRed(false);
+            s->setRed(true);
+            if (left) {
+                rotate_right(s);
+            } else {
+                rotate_left(s);
+            }
+            far = s;
+            s = near;
+        }
+        s->setRed(p->isRed());
+        p->setRed(false);
+        far->setRed(false);
+        if (left) {
+            rotate_left(p);
+        } else {
+            rotate_right(p);
+        }
+        return;
+    }
+    if (n != nullptr) {
+        n->setRed(false);
+    }
+}
+
+/**
+ * Return true iff the tree keeps the red-black rules: the root is black, no
+ * red node has a red child, and every path down to a missing child passes
+ * the same number of black nodes. The heights of the two sides may differ by
+ * more than one, so the AVL check that BinarySearchTree uses doesn't apply.
+ */
+template <class Key, class Value, class Compare>
+bool RBTree<Key, Value, Compare>::isBalanced() const {
+    RBNode<Key, Value>* node = static_cast<RBNode<Key, Value>*>(this->root_);
+    if (node == nullptr) {
+        return true;
+    }
+    if (node->isRed()) {
+        return false;
+    }
+    // Walks the tree in post-order using the parent pointers, like
+    // BinarySearchTree::isBalanced, keeping the black heights of finished
+    // subtrees on an explicit stack.
+    std::vector<int> heights;
+    RBNode<Key, Value>* prev = nullptr;
+    while (node != nullptr) {
+        RBNode<Key, Value>* parent = node->getParent();
+        RBNode<Key, Value>* left = node->getLeft();
+        RBNode<Key, Value>* right = node->getRight();
+        if (prev == parent) {
+            // First visit: go left
+            if (node->isRed() && (is_red(left) || is_red(right))) {
+                return false;
+            }
+            if (left != nullptr) {
+                prev = node;
+                node = left;
+                continue;
+            }
+            heights.push_back(0);
+        }
+        if (prev == parent || (left != nullptr && prev == left)) {
+            // Left subtree is done: go right
+            if (right != nullptr) {
+                prev = node;
+                node = right;
+                continue;
+            }
+            heights.push_back(0);
+        }
+        // Both subtrees are done
+        int rightHeight = heights.back();
+        heights.pop_back();
+        if (heights.back() != rightHeight) {
+            return false;
+        }
+        heights.back() = rightHeight + (node->isRed() ? 0 : 1);
+        prev = node;
+        node = parent;
+    }
+    return true;
+}
+
+template <class Key, class Value, class Compare>
+bool RBTree<Key, Value, Compare>::is_red(RBNode<Key, Value>* node) {
+    return node != nullptr && node->isRed();
+}
+
+template <class Key, class Value, class Compare>
+void RBTree<Key, Value, Compare>::rotate_right(RBNode<Key, Value>* y) {
+    BST_NOTE_ROTATION();
+    RBNode<Key, Value>* x = y->getLeft();
+    RBNode<Key, Value>* b = x->getRight();
+    RBNode<Key, Value>* p = y->getParent();
+    if (p == nullptr) {
+        this->root_ = x;
+    } else if (p->getLeft() == y) {
+        p->setLeft(x);
+    } else {
+        p->setRight(x);
+    }
+    y->setParent(x);
+    y->setLeft(b);
+    x->setParent(p);
+    x->setRight(y);
+    if (b != nullptr) {
+        b->setParent(y);
+    }
+}
+
+template <class Key, class Value, class Compare>
+void RBTree<Key, Value, Compare>::rotate_left(RBNode<Key, Value>* x) {
+    BST_NOTE_ROTATION();
+    RBNode<Key, Value>* y = x->getRight();
+    RBNode<Key, Value>* b = y->getLeft();
+    RBNode<Key, Value>* p = x->getParent();
+    if (p == nullptr) {
+        this->root_ = y;
+    } else if (p->getLeft() == x) {
+        p->setLeft(y);
+    } else {
+        p->setRight(y);
+    }
+    x->setParent(y);
+    x->setRight(b);
+    y->setParent(p);
+    y->setLeft(x);
+    if (b != nullptr) {
+        b->setParent(x);
+    }
+}
+
+template <class Key, class Value, class Compare>
+void RBTree<Key, Value, Compare>::nodeSwap(RBNode<Key, Value>* n1,
+                                           RBNode<Key, Value>* n2) {
+    BinarySearchTree<Key, Value, Compare>::nodeSwap(n1, n2);
+    bool tempRed = n1->isRed();
+    n1->setRed(n2->isRed());
+    n2->setRed(tempRed);
+}
+
+/**
+ * build_from_sorted gives the left subtree of a node of size s the larger
+ * half, s / 2. A subtree of size s colored this way has floor(log2(s + 1))
+ * black nodes on each path, so the two halves only differ when the left one
+ * is perfect, i.e. has a size of 2^k - 1, and with it all black. Making its
+ * root red then evens them out.
+ */
+template <class Key, class Value, class Compare>
+void RBTree<Key, Value, Compare>::build_fix(Node<Key, Value>* node,
+                                            std::size_t leftSize,
+                                            std::size_t rightSize) {
+    RBNode<Key, Value>* n = static_cast<RBNode<Key, Value>*>(node);
+    n->setRed(false);
+    if (leftSize != rightSize && (leftSize & (leftSize + 1)) == 0) {
+        n->getLeft()->setRed(true);
+    }
+}
+
+#endif
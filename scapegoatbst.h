@@ -0,0 +1,212 @@
+#ifndef SCAPEGOATBST_H
+#define SCAPEGOATBST_H
+
+#include "bst.h"
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+
+/**
+ * A scapegoat tree (Galperin and Rivest): a plain binary search tree that
+ * stays balanced without keeping any balance information in its nodes. Its
+ * height is kept within log(n) / log(1 / alpha) + 1. When an insert goes
+ * deeper than that, it climbs back up to an ancestor whose subtree is too
+ * small for the depth below it, the scapegoat, and rebuilds that subtree in
+ * place to minimum height (see rebuild_subtree), in time linear in its
+ * size. When removals shrink the tree below alpha times its largest size
+ * since the last full rebuild, the whole tree is rebuilt. Both kinds of
+ * rebuild are rare enough that inserts and removals take O(log n)
+ * amortized, and lookups O(log n) worst case.
+ *
+ * The nodes are those of the plain tree, without subtree sizes. The tree
+ * only keeps count of its items, and the climb to the scapegoat counts the
+ * subtrees it passes, which costs no more than rebuilding the scapegoat.
+ * alpha, between 0.5 and 1, trades lookup speed for update speed: the
+ * smaller it is, the shallower the tree and the more often it is rebuilt.
+ */
+template <class Key, class Value, class Compare = std::less<Key> >
+class ScapegoatTree : public BinarySearchTree<Key, Value, Compare> {
+  public:
+    ScapegoatTree();
+    explicit ScapegoatTree(const Compare& comp);
+    void setAlpha(double alpha);
+    virtual void remove(const Key& key);
+    std::size_t size() const;
+
+  protected:
+    virtual Node<Key, Value>* insert_item(ItemMaker<Key, Value>& maker,
+                                          Node<Key, Value>* hint,
+                                          bool& inserted);
+    virtual void build_fix(Node<Key, Value>* node, std::size_t leftSize,
+                           std::size_t rightSize);
+
+  private:
+    void rebalance_after_insert(Node<Key, Value>* node);
+    static std::size_t count_subtree(Node<Key, Value>* node);
+
+    double alpha_;
+    std::size_t size_;    // number of items, if root_ isn't NULL
+    std::size_t maxSize_; // largest size since the last full rebuild
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the ScapegoatTree class.
+  ---------------------------------------------------
+*/
+
+template <class Key, class Value, class Compare>
+ScapegoatTree<Key, Value, Compare>::ScapegoatTree()
+    : alpha_(0.7), size_(0), maxSize_(0) {}
+
+/**
+ * Constructs an empty tree ordered by a copy of comp.
+ */
+template <class Key, class Value, class Compare>
+ScapegoatTree<Key, Value, Compare>::ScapegoatTree(const Compare& comp)
+    : BinarySearchTree<Key, Value, Compare>(comp), alpha_(0.7), size_(0),
+      maxSize_(0) {}
+
+/**
+ * Sets alpha, which must be at least 0.5 and less than 1. The default is
+ * 0.7. A tree that is already taller than the new bound is left as it is
+ * until its next insert or rebuild.
+ */
+template <class Key, class Value, class Compare>
+void ScapegoatTree<Key, Value, Compare>::setAlpha(double alpha) {
+    if (!(alpha >= 0.5 && alpha < 1)) {
+        throw std::invalid_argument("alpha must be in [0.5, 1)");
+    }
+    alpha_ = alpha;
+}
+
+/**
+ * Every insertion, including the emplace family, goes through here.
+ */
+template <class Key, class Value, class Compare>
+Node<Key, Value>* ScapegoatTree<Key, Value, Compare>::insert_item(
+    ItemMaker<Key, Value>& maker, Node<Key, Value>* hint, bool& inserted) {
+    if (this->root_ == nullptr) {
+        this->root_ = this->create_node(maker, nullptr);
+        inserted = true;
+        this->finger_ = this->root_;
+        size_ = 1;
+        maxSize_ = 1;
+        return this->root_;
+    }
+    Node<Key, Value>* parent;
+    bool left;
+    Node<Key, Value>* node = this->find_slot(
+        maker.key(), this->insert_start(maker.key(), hint), parent, left);
+    if (node != nullptr) {
+        maker.found(node->getValue());
+        inserted = false;
+        this->finger_ = node;
+        return node;
+    }
+
+    node = this->create_node(maker, parent);
+    if (left) {
+        parent->setLeft(node);
+    } else {
+        parent->setRight(node);
+    }
+    if (++size_ > maxSize_) {
+        maxSize_ = size_;
+    }
+    rebalance_after_insert(node);
+    inserted = true;
+    this->finger_ = node;
+    return node;
+}
+
+// If node is deeper than the tree's height bound, finds the scapegoat above
+// it and rebuilds that. With i the distance from node up to an ancestor,
+// the scapegoat is the lowest ancestor whose subtree is smaller than
+// (1 / alpha)^i, i.e. too small to be i levels tall. If the bound was
+// broken one is sure to exist, though it may be the root itself, and
+// rebuilding it makes node's path short enough again. Each ancestor's size
+// is the size of the one below plus one plus a count of its other subtree,
+// so the climb only ever counts nodes that are about to be rebuilt.
+template <class Key, class Value, class Compare>
+void ScapegoatTree<Key, Value, Compare>::rebalance_after_insert(
+    Node<Key, Value>* node) {
+    int depth = 0;
+    for (Node<Key, Value>* p = node->getParent(); p != nullptr;
+         p = p->getParent()) {
+        depth++;
+    }
+    const double growth = 1 / alpha_;
+    if (std::pow(growth, depth) <= (double)size_) {
+        return;
+    }
+    double limit = 1;
+    std::size_t size = 1;
+    Node<Key, Value>* child = node;
+    for (Node<Key, Value>* p = node->getParent(); p != nullptr;
+         p = p->getParent()) {
+        limit *= growth;
+        size += 1 + count_subtree(child == p->getLeft() ? p->getRight()
+                                                        : p->getLeft());
+        if ((double)size < limit) {
+            this->rebuild_subtree(p);
+            return;
+        }
+        child = p;
+    }
+}
+
+// Counts the nodes in the subtree at node, which may be NULL. Recurses only
+// as deep as the subtree is tall, which the tree keeps logarithmic.
+template <class Key, class Value, class Compare>
+std::size_t ScapegoatTree<Key, Value, Compare>::count_subtree(
+    Node<Key, Value>* node) {
+    if (node == nullptr) {
+        return 0;
+    }
+    return 1 + count_subtree(node->getLeft()) +
+           count_subtree(node->getRight());
+}
+
+/**
+ * Removes like the plain tree. If that leaves fewer than alpha times as many
+ * items as the tree had at its largest, the whole tree is rebuilt.
+ */
+template <class Key, class Value, class Compare>
+void ScapegoatTree<Key, Value, Compare>::remove(const Key& key) {
+    if (this->internalFind(key) == nullptr) {
+        return;
+    }
+    BinarySearchTree<Key, Value, Compare>::remove(key);
+    size_--;
+    if ((double)size_ < alpha_ * (double)maxSize_) {
+        this->rebuild_subtree(this->root_);
+        maxSize_ = size_;
+    }
+}
+
+/**
+ * Returns the number of items in O(1), from the count the tree keeps.
+ */
+template <class Key, class Value, class Compare>
+std::size_t ScapegoatTree<Key, Value, Compare>::size() const {
+    // clear() empties the tree without going through here
+    return this->root_ == nullptr ? 0 : size_;
+}
+
+// build_from_sorted and rebuild_subtree call this for every node they
+// finish, bottom up, so the last one without a parent is the top of the
+// whole tree. Either way the tree has just been rebuilt in full, and now
+// holds leftSize + rightSize + 1 items.
+template <class Key, class Value, class Compare>
+void ScapegoatTree<Key, Value, Compare>::build_fix(Node<Key, Value>* node,
+                                                    std::size_t leftSize,
+                                                    std::size_t rightSize) {
+    if (node->getParent() == nullptr) {
+        size_ = leftSize + rightSize + 1;
+        maxSize_ = size_;
+    }
+}
+
+#endif
@@ -0,0 +1,423 @@
+#ifndef SHARDED_AVLBST_H
+#define SHARDED_AVLBST_H
+
+#include "avlbst.h"
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * A map spread over several independent AVLTrees (shards), each with its own
+ * lock, so that threads writing to different shards don't wait for each
+ * other.
+ *
+ * Keys are assigned to shards either by hash, which spreads any workload
+ * evenly, or by range, given a sorted list of split keys. With ranges the
+ * shards hold consecutive slices of the key space, so walking them in order
+ * visits every key in order.
+ *
+ * Every operation locks the shard it uses, so any of them may run while
+ * other threads write. Nothing hands out references into a shard past its
+ * lock: operator[] returns a copy of the value, and iterators hold copies
+ * of the items, taking a few dozen at a time from their shard under its
+ * lock. An iteration therefore never blocks writers for long, and sees each
+ * item as it was when it was copied; keys inserted or removed ahead of it
+ * while it runs may or may not be visited. Change values with insert, not
+ * through an iterator.
+ */
+template <class Key, class Value, class Hash = std::hash<Key> >
+class ShardedAVLMap {
+  public:
+    explicit ShardedAVLMap(std::size_t shards = 16);
+    explicit ShardedAVLMap(const std::vector<Key>& splitKeys);
+
+    void insert(const std::pair<const Key, Value>& new_item);
+    void remove(const Key& key);
+    void clear();
+    template <typename InputIt>
+    BatchInsertResult insert_batch(InputIt first, InputIt last);
+
+    bool find(const Key& key, Value& value) const;
+    std::size_t size() const;
+    bool empty() const;
+    bool ordered() const;
+    std::size_t shard_count() const;
+    std::size_t shard_of(const Key& key) const;
+
+    /**
+     * Walks the shards one after the other. In range mode that is key order.
+     */
+    class iterator {
+      public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+      private:
+        friend class ShardedAVLMap<Key, Value, Hash>;
+        typedef std::vector<std::pair<const Key, Value> > Items;
+
+        // How many items are copied per visit to a shard. Enough to make
+        // the lock and the search for where to go on cheap per item.
+        static const std::size_t kChunk = 64;
+
+        iterator(const ShardedAVLMap<Key, Value, Hash>* map,
+                 std::size_t shard);
+        void load(const Key* from, bool inclusive, std::size_t count);
+
+        const ShardedAVLMap<Key, Value, Hash>* map_;
+        std::size_t shard_;
+        std::shared_ptr<const Items> items_; // NULL at the end
+        std::size_t index_;                  // of the current item in items_
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value operator[](const Key& key) const;
+
+  private:
+    struct Shard {
+        mutable std::mutex lock;
+        AVLTree<Key, Value> tree;
+    };
+
+    ShardedAVLMap(const ShardedAVLMap&);
+    ShardedAVLMap& operator=(const ShardedAVLMap&);
+
+    void make_shards(std::size_t count);
+
+    std::vector<std::unique_ptr<Shard> > shards_;
+    // Shard i holds keys in [splitKeys_[i - 1], splitKeys_[i]). Empty in
+    // hash mode.
+    std::vector<Key> splitKeys_;
+    Hash hash_;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the ShardedAVLMap class.
+  -----------------------------------------------------
+*/
+
+/**
+ * Creates a hash-partitioned map with the given number of shards.
+ */
+template <class Key, class Value, class Hash>
+ShardedAVLMap<Key, Value, Hash>::ShardedAVLMap(std::size_t shards) {
+    make_shards(shards == 0 ? 1 : shards);
+}
+
+/**
+ * Creates a range-partitioned map with one more shard than there are split
+ * keys, which must be strictly increasing.
+ */
+template <class Key, class Value, class Hash>
+ShardedAVLMap<Key, Value, Hash>::ShardedAVLMap(
+    const std::vector<Key>& splitKeys)
+    : splitKeys_(splitKeys) {
+    if (splitKeys_.empty()) {
+        throw std::invalid_argument("Range sharding needs split keys");
+    }
+    for (std::size_t i = 1; i < splitKeys_.size(); i++) {
+        if (!(splitKeys_[i - 1] < splitKeys_[i])) {
+            throw std::invalid_argument("Split keys out of order");
+        }
+    }
+    make_shards(splitKeys_.size() + 1);
+}
+
+/**
+ * Inserts or overwrites an item, locking only its shard.
+ */
+template <class Key, class Value, class Hash>
+void ShardedAVLMap<Key, Value, Hash>::insert(
+    const std::pair<const Key, Value>& new_item) {
+    Shard& shard = *shards_[shard_of(new_item.first)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    shard.tree.insert(new_item);
+}
+
+template <class Key, class Value, class Hash>
+void ShardedAVLMap<Key, Value, Hash>::remove(const Key& key) {
+    Shard& shard = *shards_[shard_of(key)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    shard.tree.remove(key);
+}
+
+/**
+ * Empties the shards one at a time.
+ */
+template <class Key, class Value, class Hash>
+void ShardedAVLMap<Key, Value, Hash>::clear() {
+    for (std::size_t i = 0; i < shards_.size(); i++) {
+        std::lock_guard<std::mutex> guard(shards_[i]->lock);
+        shards_[i]->tree.clear();
+    }
+}
+
+/**
+ * Splits the items up by shard and hands each shard its part with
+ * AVLTree::insert_batch, holding one shard's lock at a time. As with that,
+ * the last pair for a key wins.
+ */
+template <class Key, class Value, class Hash>
+template <typename InputIt>
+BatchInsertResult ShardedAVLMap<Key, Value, Hash>::insert_batch(InputIt first,
+                                                                InputIt last) {
+    std::vector<std::vector<std::pair<Key, Value> > > parts(shards_.size());
+    for (; first != last; ++first) {
+        parts[shard_of(first->first)].push_back(*first);
+    }
+    BatchInsertResult result;
+    result.inserted = 0;
+    result.overwritten = 0;
+    for (std::size_t i = 0; i < parts.size(); i++) {
+        if (parts[i].empty()) {
+            continue;
+        }
+        std::lock_guard<std::mutex> guard(shards_[i]->lock);
+        BatchInsertResult part =
+            shards_[i]->tree.insert_batch(parts[i].begin(), parts[i].end());
+        result.inserted += part.inserted;
+        result.overwritten += part.overwritten;
+    }
+    return result;
+}
+
+/**
+ * Copies the value for key into value and returns true, or returns false if
+ * the key isn't there. Locks the key's shard.
+ */
+template <class Key, class Value, class Hash>
+bool ShardedAVLMap<Key, Value, Hash>::find(const Key& key,
+                                           Value& value) const {
+    const Shard& shard = *shards_[shard_of(key)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    typename AVLTree<Key, Value>::iterator it = shard.tree.find(key);
+    if (it == shard.tree.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+/**
+ * Adds up the shard sizes, locking each in turn while its items are counted,
+ * so it takes O(n). With concurrent writers the total is only a snapshot of
+ * each shard at a slightly different time.
+ */
+template <class Key, class Value, class Hash>
+std::size_t ShardedAVLMap<Key, Value, Hash>::size() const {
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < shards_.size(); i++) {
+        std::lock_guard<std::mutex> guard(shards_[i]->lock);
+        total += shards_[i]->tree.size();
+    }
+    return total;
+}
+
+/**
+ * Looks at the shards one at a time, stopping at the first with an item.
+ */
+template <class Key, class Value, class Hash>
+bool ShardedAVLMap<Key, Value, Hash>::empty() const {
+    for (std::size_t i = 0; i < shards_.size(); i++) {
+        std::lock_guard<std::mutex> guard(shards_[i]->lock);
+        if (!shards_[i]->tree.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Returns true if iteration visits the keys in order, i.e. in range mode.
+ */
+template <class Key, class Value, class Hash>
+bool ShardedAVLMap<Key, Value, Hash>::ordered() const {
+    return !splitKeys_.empty();
+}
+
+template <class Key, class Value, class Hash>
+std::size_t ShardedAVLMap<Key, Value, Hash>::shard_count() const {
+    return shards_.size();
+}
+
+/**
+ * Returns the index of the shard that holds key.
+ */
+template <class Key, class Value, class Hash>
+std::size_t ShardedAVLMap<Key, Value, Hash>::shard_of(const Key& key) const {
+    if (splitKeys_.empty()) {
+        return hash_(key) % shards_.size();
+    }
+    return std::upper_bound(splitKeys_.begin(), splitKeys_.end(), key) -
+           splitKeys_.begin();
+}
+
+template <class Key, class Value, class Hash>
+typename ShardedAVLMap<Key, Value, Hash>::iterator
+ShardedAVLMap<Key, Value, Hash>::begin() const {
+    iterator it(this, 0);
+    it.load(nullptr, true, iterator::kChunk);
+    return it;
+}
+
+template <class Key, class Value, class Hash>
+typename ShardedAVLMap<Key, Value, Hash>::iterator
+ShardedAVLMap<Key, Value, Hash>::end() const {
+    return iterator(this, shards_.size());
+}
+
+/**
+ * Returns an iterator to the item with the given key, or end(). Locks the
+ * key's shard while it copies the item. The items after it are only copied
+ * if the iterator is advanced.
+ */
+template <class Key, class Value, class Hash>
+typename ShardedAVLMap<Key, Value, Hash>::iterator
+ShardedAVLMap<Key, Value, Hash>::find(const Key& key) const {
+    std::size_t shard = shard_of(key);
+    iterator it(this, shard);
+    it.load(&key, true, 1);
+    // If the key's shard has nothing from key on, load() has gone on to a
+    // later shard, whose first key may well be smaller in hash mode
+    if (it.shard_ != shard || key < it->first || it->first < key) {
+        return end();
+    }
+    return it;
+}
+
+/**
+ * Returns a copy of the value for key, locking its shard. Throws
+ * std::out_of_range if the key isn't there.
+ */
+template <class Key, class Value, class Hash>
+Value ShardedAVLMap<Key, Value, Hash>::operator[](const Key& key) const {
+    const Shard& shard = *shards_[shard_of(key)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    return shard.tree[key];
+}
+
+template <class Key, class Value, class Hash>
+void ShardedAVLMap<Key, Value, Hash>::make_shards(std::size_t count) {
+    for (std::size_t i = 0; i < count; i++) {
+        shards_.push_back(std::unique_ptr<Shard>(new Shard()));
+    }
+}
+
+/*
+  ---------------------------------------------------------------
+  Begin implementations for the ShardedAVLMap::iterator class.
+  ---------------------------------------------------------------
+*/
+
+template <class Key, class Value, class Hash>
+ShardedAVLMap<Key, Value, Hash>::iterator::iterator()
+    : map_(nullptr), shard_(0), index_(0) {}
+
+/**
+ * An iterator in front of shard, which load() has to fill in. A shard of
+ * map->shard_count() makes it end().
+ */
+template <class Key, class Value, class Hash>
+ShardedAVLMap<Key, Value, Hash>::iterator::iterator(
+    const ShardedAVLMap<Key, Value, Hash>* map, std::size_t shard)
+    : map_(map), shard_(shard), index_(0) {}
+
+template <class Key, class Value, class Hash>
+const std::pair<const Key, Value>&
+ShardedAVLMap<Key, Value, Hash>::iterator::operator*() const {
+    return (*items_)[index_];
+}
+
+template <class Key, class Value, class Hash>
+const std::pair<const Key, Value>*
+ShardedAVLMap<Key, Value, Hash>::iterator::operator->() const {
+    return &(*items_)[index_];
+}
+
+/**
+ * Iterators are equal if they are at the same key, wherever they got their
+ * copies of it.
+ */
+template <class Key, class Value, class Hash>
+bool ShardedAVLMap<Key, Value, Hash>::iterator::operator==(
+    const iterator& rhs) const {
+    if (shard_ != rhs.shard_ || !items_ != !rhs.items_) {
+        return false;
+    }
+    if (!items_) {
+        return true;
+    }
+    const Key& a = (*items_)[index_].first;
+    const Key& b = (*rhs.items_)[rhs.index_].first;
+    return !(a < b) && !(b < a);
+}
+
+template <class Key, class Value, class Hash>
+bool ShardedAVLMap<Key, Value, Hash>::iterator::operator!=(
+    const iterator& rhs) const {
+    return !(*this == rhs);
+}
+
+/**
+ * Moves on to the next copied item, and once those run out, copies the
+ * next ones after it from the shard, or from the next non-empty shard at
+ * its end.
+ */
+template <class Key, class Value, class Hash>
+typename ShardedAVLMap<Key, Value, Hash>::iterator&
+ShardedAVLMap<Key, Value, Hash>::iterator::operator++() {
+    if (++index_ == items_->size()) {
+        // load() keeps the old copies until it is done with the key
+        load(&items_->back().first, false, kChunk);
+    }
+    return *this;
+}
+
+// Copies up to count items from shard_, starting at the first key not less
+// than *from (greater, if not inclusive), or at the shard's first key if
+// from is NULL. If there are none, moves on to the start of the next shard
+// that has some, and at the very end, ends up equal to end(). Holds one
+// shard's lock at a time.
+template <class Key, class Value, class Hash>
+void ShardedAVLMap<Key, Value, Hash>::iterator::load(const Key* from,
+                                                      bool inclusive,
+                                                      std::size_t count) {
+    std::shared_ptr<Items> items = std::make_shared<Items>();
+    for (; shard_ < map_->shards_.size(); shard_++, from = nullptr) {
+        const Shard& shard = *map_->shards_[shard_];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        typename AVLTree<Key, Value>::iterator it =
+            from == nullptr ? shard.tree.begin()
+            : inclusive     ? shard.tree.lower_bound(*from)
+                            : shard.tree.upper_bound(*from);
+        for (; it != shard.tree.end() && items->size() < count; ++it) {
+            items->push_back(*it);
+        }
+        if (!items->empty()) {
+            break;
+        }
+    }
+    index_ = 0;
+    if (items->empty()) {
+        items_.reset();
+    } else {
+        items_ = items;
+    }
+}
+
+#endif
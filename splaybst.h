@@ -0,0 +1,228 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include "bst.h"
+#include <functional>
+#include <utility>
+
+/**
+ * How far a SplayTree moves the nodes it accesses. SPLAY_FULL brings them to
+ * the root. SPLAY_SEMI only moves them about halfway up, rotating once per
+ * two levels where a full splay of a straight path rotates twice, so it
+ * writes less but adapts more slowly.
+ */
+enum SplayMode { SPLAY_FULL, SPLAY_SEMI };
+
+/**
+ * A self-adjusting binary search tree (Sleator and Tarjan). find and insert
+ * move the node they land on up towards the root, so keys that are asked for
+ * often stay near the top: a sequence of accesses costs O(log n) amortized
+ * each, and much less when a few keys take most of them. It keeps no balance
+ * information, so its nodes are plain BST nodes.
+ *
+ * Every splay rewrites the links along the path, which costs cache traffic
+ * and makes even lookups writes. setSplayMode can make it semi-splay, or
+ * only splay on every k-th access and leave the others as plain lookups.
+ * find on a const tree never splays. remove doesn't either.
+ */
+template <class Key, class Value, class Compare = std::less<Key> >
+class SplayTree : public BinarySearchTree<Key, Value, Compare> {
+  public:
+    typedef typename BinarySearchTree<Key, Value, Compare>::iterator iterator;
+
+    SplayTree();
+    explicit SplayTree(const Compare& comp);
+    void setSplayMode(SplayMode mode, unsigned every = 1);
+
+    using BinarySearchTree<Key, Value, Compare>::find;
+    iterator find(const Key& key);
+
+  protected:
+    virtual Node<Key, Value>* insert_item(ItemMaker<Key, Value>& maker,
+                                          Node<Key, Value>* hint,
+                                          bool& inserted);
+
+  private:
+    void access(Node<Key, Value>* node);
+    void splay(Node<Key, Value>* x);
+    void semi_splay(Node<Key, Value>* x);
+    void rotate_up(Node<Key, Value>* x);
+
+    SplayMode mode_;
+    unsigned every_;   // splay on every every_-th access
+    unsigned skipped_; // accesses since the last splay
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the SplayTree class.
+  -----------------------------------------------
+*/
+
+template <class Key, class Value, class Compare>
+SplayTree<Key, Value, Compare>::SplayTree()
+    : mode_(SPLAY_FULL), every_(1), skipped_(0) {}
+
+/**
+ * Constructs an empty tree ordered by a copy of comp.
+ */
+template <class Key, class Value, class Compare>
+SplayTree<Key, Value, Compare>::SplayTree(const Compare& comp)
+    : BinarySearchTree<Key, Value, Compare>(comp), mode_(SPLAY_FULL),
+      every_(1), skipped_(0) {}
+
+/**
+ * Chooses full or semi-splaying, and splays on only every k-th access (find
+ * or insert) if every is k > 1. The default is a full splay every time.
+ */
+template <class Key, class Value, class Compare>
+void SplayTree<Key, Value, Compare>::setSplayMode(SplayMode mode,
+                                                  unsigned every) {
+    mode_ = mode;
+    every_ = every > 0 ? every : 1;
+    skipped_ = 0;
+}
+
+/**
+ * Returns an iterator to the item with the given key, or end(), and splays
+ * the node found. If the key isn't there, the last node looked at is
+ * splayed instead, as the standard splay tree does.
+ */
+template <class Key, class Value, class Compare>
+typename SplayTree<Key, Value, Compare>::iterator
+SplayTree<Key, Value, Compare>::find(const Key& key) {
+    if (this->root_ == nullptr) {
+        return this->end();
+    }
+    Node<Key, Value>* parent;
+    bool left;
+    Node<Key, Value>* found = this->find_slot(key, this->root_, parent, left);
+    // Splaying doesn't move items between nodes, so found stays valid
+    access(found != nullptr ? found : parent);
+    return this->node_iterator(found);
+}
+
+/**
+ * Inserts like the other trees, then splays the node that holds the key.
+ */
+template <class Key, class Value, class Compare>
+Node<Key, Value>* SplayTree<Key, Value, Compare>::insert_item(
+    ItemMaker<Key, Value>& maker, Node<Key, Value>* hint, bool& inserted) {
+    if (this->root_ == nullptr) {
+        this->root_ = this->create_node(maker, nullptr);
+        inserted = true;
+        this->finger_ = this->root_;
+        return this->root_;
+    }
+    Node<Key, Value>* parent;
+    bool left;
+    Node<Key, Value>* node = this->find_slot(
+        maker.key(), this->insert_start(maker.key(), hint), parent, left);
+    inserted = node == nullptr;
+    if (node != nullptr) {
+        maker.found(node->getValue());
+    } else {
+        node = this->create_node(maker, parent);
+        if (left) {
+            parent->setLeft(node);
+        } else {
+            parent->setRight(node);
+        }
+    }
+    this->finger_ = node;
+    access(node);
+    return node;
+}
+
+// Splays node, or not, depending on the mode and how many accesses went by
+template <class Key, class Value, class Compare>
+void SplayTree<Key, Value, Compare>::access(Node<Key, Value>* node) {
+    if (++skipped_ < every_) {
+        return;
+    }
+    skipped_ = 0;
+    if (mode_ == SPLAY_SEMI) {
+        semi_splay(node);
+    } else {
+        splay(node);
+    }
+}
+
+// Rotates x up to the root, two levels at a time: rotating the parent first
+// when x and its parent are children on the same side (zig-zig), and x twice
+// otherwise (zig-zag). That roughly halves the depth of every node on the
+// path, not just x's.
+template <class Key, class Value, class Compare>
+void SplayTree<Key, Value, Compare>::splay(Node<Key, Value>* x) {
+    while (x->getParent() != nullptr) {
+        Node<Key, Value>* p = x->getParent();
+        Node<Key, Value>* g = p->getParent();
+        if (g == nullptr) {
+            // zig
+            rotate_up(x);
+        } else if ((x == p->getLeft()) == (p == g->getLeft())) {
+            // zig-zig
+            rotate_up(p);
+            rotate_up(x);
+        } else {
+            // zig-zag
+            rotate_up(x);
+            rotate_up(x);
+        }
+    }
+}
+
+// Like splay, except that in the zig-zig case only the parent is rotated and
+// the splay carries on from there, leaving x where it is below it. x ends up
+// about halfway to the root, and the path is still about halved.
+template <class Key, class Value, class Compare>
+void SplayTree<Key, Value, Compare>::semi_splay(Node<Key, Value>* x) {
+    while (x->getParent() != nullptr) {
+        Node<Key, Value>* p = x->getParent();
+        Node<Key, Value>* g = p->getParent();
+        if (g == nullptr) {
+            // zig
+            rotate_up(x);
+        } else if ((x == p->getLeft()) == (p == g->getLeft())) {
+            // zig-zig
+            rotate_up(p);
+            x = p;
+        } else {
+            // zig-zag
+            rotate_up(x);
+            rotate_up(x);
+        }
+    }
+}
+
+// Rotates x above its parent
+template <class Key, class Value, class Compare>
+void SplayTree<Key, Value, Compare>::rotate_up(Node<Key, Value>* x) {
+    BST_NOTE_ROTATION();
+    Node<Key, Value>* p = x->getParent();
+    Node<Key, Value>* g = p->getParent();
+    Node<Key, Value>* b;
+    if (x == p->getLeft()) {
+        b = x->getRight();
+        p->setLeft(b);
+        x->setRight(p);
+    } else {
+        b = x->getLeft();
+        p->setRight(b);
+        x->setLeft(p);
+    }
+    if (b != nullptr) {
+        b->setParent(p);
+    }
+    p->setParent(x);
+    x->setParent(g);
+    if (g == nullptr) {
+        this->root_ = x;
+    } else if (g->getLeft() == p) {
+        g->setLeft(x);
+    } else {
+        g->setRight(x);
+    }
+}
+
+#endif
@@ -0,0 +1,365 @@
+#ifndef STATIC_BTREE_H
+#define STATIC_BTREE_H
+
+#include "bst.h"
+#include "node_alloc.h"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Node searches for StaticBTree. Each returns how many of the 16 sorted keys
+ * in node are less than x. int32_t and float keys are compared 8 (AVX2) or 4
+ * (SSE2) at a time when the compiler targets those; anything else, or a
+ * build without them, uses the plain loop. node must be 64-byte aligned, so
+ * that those 16 keys are exactly one cache line.
+ */
+
+inline unsigned btree_popcount(unsigned mask) {
+#if defined(__GNUC__)
+    return __builtin_popcount(mask);
+#else
+    unsigned count = 0;
+    for (; mask != 0; mask &= mask - 1) {
+        count++;
+    }
+    return count;
+#endif
+}
+
+template <typename T> unsigned btree_node_rank(const T* node, const T& x) {
+    unsigned rank = 0;
+    for (int i = 0; i < 16; i++) {
+        rank += node[i] < x;
+    }
+    return rank;
+}
+
+#if defined(__AVX2__)
+
+inline unsigned btree_node_rank(const int32_t* node, const int32_t& x) {
+    __m256i xs = _mm256_set1_epi32(x);
+    __m256i lo = _mm256_load_si256(reinterpret_cast<const __m256i*>(node));
+    __m256i hi = _mm256_load_si256(reinterpret_cast<const __m256i*>(node + 8));
+    unsigned mask =
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(xs, lo))) |
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(xs, hi)))
+            << 8;
+    return btree_popcount(mask);
+}
+
+inline unsigned btree_node_rank(const float* node, const float& x) {
+    __m256 xs = _mm256_set1_ps(x);
+    __m256 lo = _mm256_load_ps(node);
+    __m256 hi = _mm256_load_ps(node + 8);
+    unsigned mask = _mm256_movemask_ps(_mm256_cmp_ps(lo, xs, _CMP_LT_OQ)) |
+                    _mm256_movemask_ps(_mm256_cmp_ps(hi, xs, _CMP_LT_OQ)) << 8;
+    return btree_popcount(mask);
+}
+
+#elif defined(__SSE2__)
+
+inline unsigned btree_node_rank(const int32_t* node, const int32_t& x) {
+    __m128i xs = _mm_set1_epi32(x);
+    unsigned mask = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i keys =
+            _mm_load_si128(reinterpret_cast<const __m128i*>(node + 4 * i));
+        mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(xs, keys)))
+                << (4 * i);
+    }
+    return btree_popcount(mask);
+}
+
+inline unsigned btree_node_rank(const float* node, const float& x) {
+    __m128 xs = _mm_set1_ps(x);
+    unsigned mask = 0;
+    for (int i = 0; i < 4; i++) {
+        mask |= _mm_movemask_ps(_mm_cmplt_ps(_mm_load_ps(node + 4 * i), xs))
+                << (4 * i);
+    }
+    return btree_popcount(mask);
+}
+
+#endif
+
+/**
+ * A read-only index over numeric keys, laid out as a static B+ tree: the
+ * sorted keys are cut into nodes of 16 (one cache line of 32-bit keys), and
+ * each layer above holds, for every node, the smallest keys of the subtrees
+ * to the right of its first. The layers are stored bottom-up in one array
+ * with no pointers; a node's children are found by arithmetic. Finding a key
+ * takes one node search per layer, log17(n) + 1 in all.
+ *
+ * Keys must be arithmetic, and NaN isn't allowed as a key. The ends of the
+ * layers are padded with +infinity, or the largest value for keys without
+ * one, which no key is greater than; such a key can still be stored.
+ */
+template <class Key, class Value> class StaticBTree {
+    static_assert(std::is_arithmetic<Key>::value,
+                  "StaticBTree needs arithmetic keys");
+
+  public:
+    StaticBTree();
+    explicit StaticBTree(const BinarySearchTree<Key, Value>& tree);
+    template <typename ForwardIt> StaticBTree(ForwardIt first, ForwardIt last);
+
+    /**
+     * Visits the items in key order.
+     */
+    class iterator {
+      public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+      private:
+        friend class StaticBTree<Key, Value>;
+        explicit iterator(const std::pair<const Key, Value>* current);
+
+        const std::pair<const Key, Value>* current_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value const& operator[](const Key& key) const;
+    bool empty() const;
+    std::size_t size() const;
+
+  private:
+    static const std::size_t B = 16; // keys per node
+
+    static std::size_t blocks(std::size_t n);
+    static std::size_t parent_keys(std::size_t n);
+    static Key pad();
+    void build();
+    std::size_t lower_bound_index(const Key& key) const;
+
+    std::vector<std::pair<const Key, Value> > items_; // sorted
+    // Leaves first, root last. Every node starts a cache line.
+    std::vector<Key, CacheAlignedAllocator<Key> > layers_;
+    std::vector<std::size_t> offsets_; // where each layer starts
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the StaticBTree class.
+  ---------------------------------------------------
+*/
+
+template <class Key, class Value> StaticBTree<Key, Value>::StaticBTree() {
+    build();
+}
+
+/**
+ * Copies the items of tree in order, e.g. from an AVLTree. Takes O(n).
+ */
+template <class Key, class Value>
+StaticBTree<Key, Value>::StaticBTree(
+    const BinarySearchTree<Key, Value>& tree) {
+    items_.reserve(tree.size());
+    for (typename BinarySearchTree<Key, Value>::iterator it = tree.begin();
+         it != tree.end(); ++it) {
+        items_.push_back(*it);
+    }
+    build();
+}
+
+/**
+ * Copies the items in [first, last), which must be sorted by strictly
+ * increasing key. Takes O(n).
+ */
+template <class Key, class Value>
+template <typename ForwardIt>
+StaticBTree<Key, Value>::StaticBTree(ForwardIt first, ForwardIt last)
+    : items_(first, last) {
+    build();
+}
+
+template <class Key, class Value>
+typename StaticBTree<Key, Value>::iterator
+StaticBTree<Key, Value>::begin() const {
+    return iterator(items_.data());
+}
+
+template <class Key, class Value>
+typename StaticBTree<Key, Value>::iterator StaticBTree<Key, Value>::end() const {
+    return iterator(items_.data() + items_.size());
+}
+
+/**
+ * Returns an iterator to the item with the given key, or end().
+ */
+template <class Key, class Value>
+typename StaticBTree<Key, Value>::iterator
+StaticBTree<Key, Value>::find(const Key& key) const {
+    std::size_t i = lower_bound_index(key);
+    if (i == items_.size() || key < items_[i].first) {
+        return end();
+    }
+    return iterator(&items_[i]);
+}
+
+/**
+ * Returns an iterator to the first item whose key is not less than key.
+ */
+template <class Key, class Value>
+typename StaticBTree<Key, Value>::iterator
+StaticBTree<Key, Value>::lower_bound(const Key& key) const {
+    return iterator(items_.data() + lower_bound_index(key));
+}
+
+/**
+ * Throws std::out_of_range if the key isn't there.
+ */
+template <class Key, class Value>
+Value const& StaticBTree<Key, Value>::operator[](const Key& key) const {
+    iterator it = find(key);
+    if (it == end()) {
+        throw std::out_of_range("Invalid key");
+    }
+    return it->second;
+}
+
+template <class Key, class Value> bool StaticBTree<Key, Value>::empty() const {
+    return items_.empty();
+}
+
+template <class Key, class Value>
+std::size_t StaticBTree<Key, Value>::size() const {
+    return items_.size();
+}
+
+// Number of nodes needed for n keys
+template <class Key, class Value>
+std::size_t StaticBTree<Key, Value>::blocks(std::size_t n) {
+    return (n + B - 1) / B;
+}
+
+// Number of keys in the layer above one with n keys. Every node up there
+// separates B + 1 children.
+template <class Key, class Value>
+std::size_t StaticBTree<Key, Value>::parent_keys(std::size_t n) {
+    return (blocks(n) + B) / (B + 1) * B;
+}
+
+// The key in the slots past the last real key of each layer. No key may be
+// greater than it, or the node searches would count the padding and step to
+// children that don't exist.
+template <class Key, class Value> Key StaticBTree<Key, Value>::pad() {
+    if (std::numeric_limits<Key>::has_infinity) {
+        return std::numeric_limits<Key>::infinity();
+    }
+    return std::numeric_limits<Key>::max();
+}
+
+// Lays out the layers from the sorted items. Key k of node j in a layer is
+// the smallest key under child k + 1 of that node, which is the first key of
+// that child's leftmost leaf.
+template <class Key, class Value> void StaticBTree<Key, Value>::build() {
+    const std::size_t n = items_.size();
+    offsets_.assign(1, 0);
+    std::size_t layerKeys = n;
+    while (true) {
+        offsets_.push_back(offsets_.back() + blocks(layerKeys) * B);
+        if (layerKeys <= B) {
+            break;
+        }
+        layerKeys = parent_keys(layerKeys);
+    }
+    layers_.assign(offsets_.back(), pad());
+    for (std::size_t i = 0; i < n; i++) {
+        layers_[i] = items_[i].first;
+    }
+
+    for (std::size_t h = 1; h + 1 < offsets_.size(); h++) {
+        for (std::size_t i = 0; i < offsets_[h + 1] - offsets_[h]; i++) {
+            std::size_t node = i / B;
+            std::size_t child = node * (B + 1) + i % B + 1;
+            for (std::size_t level = 1; level < h; level++) {
+                child *= B + 1;
+            }
+            if (child * B < n) {
+                layers_[offsets_[h] + i] = layers_[child * B];
+            }
+        }
+    }
+}
+
+// Returns the index in items_ of the first key not less than key. Each layer
+// narrows the search to one child of the node searched in the layer above.
+template <class Key, class Value>
+std::size_t StaticBTree<Key, Value>::lower_bound_index(const Key& key) const {
+    if (items_.empty()) {
+        return 0;
+    }
+    const Key* layers = layers_.data();
+    std::size_t k = 0; // offset of the current node within its layer
+    for (std::size_t h = offsets_.size() - 2; h > 0; h--) {
+        std::size_t rank = btree_node_rank(layers + offsets_[h] + k, key);
+        k = k * (B + 1) + rank * B;
+    }
+    std::size_t i = k + btree_node_rank(layers + k, key);
+    return i < items_.size() ? i : items_.size();
+}
+
+/*
+  ----------------------------------------------------------
+  Begin implementations for the StaticBTree::iterator class.
+  ----------------------------------------------------------
+*/
+
+template <class Key, class Value>
+StaticBTree<Key, Value>::iterator::iterator() : current_(nullptr) {}
+
+template <class Key, class Value>
+StaticBTree<Key, Value>::iterator::iterator(
+    const std::pair<const Key, Value>* current)
+    : current_(current) {}
+
+template <class Key, class Value>
+const std::pair<const Key, Value>&
+StaticBTree<Key, Value>::iterator::operator*() const {
+    return *current_;
+}
+
+template <class Key, class Value>
+const std::pair<const Key, Value>*
+StaticBTree<Key, Value>::iterator::operator->() const {
+    return current_;
+}
+
+template <class Key, class Value>
+bool StaticBTree<Key, Value>::iterator::operator==(const iterator& rhs) const {
+    return current_ == rhs.current_;
+}
+
+template <class Key, class Value>
+bool StaticBTree<Key, Value>::iterator::operator!=(const iterator& rhs) const {
+    return current_ != rhs.current_;
+}
+
+template <class Key, class Value>
+typename StaticBTree<Key, Value>::iterator&
+StaticBTree<Key, Value>::iterator::operator++() {
+    ++current_;
+    return *this;
+}
+
+#endif
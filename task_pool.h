@@ -0,0 +1,274 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A small work-stealing thread pool for fork-join parallelism.
+ *
+ * run() hands a function to the pool and blocks until it's done. Inside it,
+ * fork_join(a, b) makes b available to idle workers, runs a, and then either
+ * runs b itself or, if b was stolen, helps with other work until b finishes.
+ * Each worker keeps its own deque of forked tasks: it works on the newest end
+ * and thieves take from the oldest, which holds the biggest pieces of work.
+ */
+class TaskPool {
+  public:
+    explicit TaskPool(unsigned threads = 0);
+    ~TaskPool();
+
+    unsigned size() const;
+    template <typename F> void run(F f);
+    template <typename F1, typename F2> void fork_join(F1 a, F2 b);
+
+  private:
+    struct Task {
+        explicit Task(const std::function<void()>& fn, bool external = false);
+
+        std::function<void()> fn;
+        std::atomic<bool> done;
+        bool external; // someone outside the pool is waiting in run()
+        std::exception_ptr error;
+    };
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task*> tasks;
+    };
+
+    TaskPool(const TaskPool&);
+    TaskPool& operator=(const TaskPool&);
+
+    void worker_loop(unsigned index);
+    void push(unsigned queue, Task* task);
+    Task* pop(unsigned queue);
+    Task* steal(unsigned thief);
+    void execute(Task* task);
+    bool on_worker() const;
+
+    static TaskPool*& current_pool();
+    static unsigned& current_index();
+
+    std::vector<std::thread> threads_;
+    // One queue per worker, plus one at the end for tasks from run()
+    std::vector<std::unique_ptr<Queue> > queues_;
+    std::atomic<long> pending_; // tasks sitting in some queue
+    std::mutex sleepLock_;
+    std::condition_variable wake_;
+    std::mutex doneLock_;
+    std::condition_variable done_;
+    bool stop_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the TaskPool class.
+  ---------------------------------------------
+*/
+
+inline TaskPool::Task::Task(const std::function<void()>& fn, bool external)
+    : fn(fn), done(false), external(external) {}
+
+/**
+ * Starts the given number of workers, or one per hardware thread if 0.
+ */
+inline TaskPool::TaskPool(unsigned threads) : pending_(0), stop_(false) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (unsigned i = 0; i <= threads; i++) {
+        queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        threads_.push_back(std::thread(&TaskPool::worker_loop, this, i));
+    }
+}
+
+/**
+ * Stops the workers. Any run() calls must have returned by now.
+ */
+inline TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> guard(sleepLock_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::size_t i = 0; i < threads_.size(); i++) {
+        threads_[i].join();
+    }
+}
+
+/**
+ * Returns the number of worker threads.
+ */
+inline unsigned TaskPool::size() const {
+    return static_cast<unsigned>(threads_.size());
+}
+
+/**
+ * Runs f on the pool and waits for it, rethrowing anything it throws. Called
+ * from one of the pool's own tasks, it just runs f.
+ */
+template <typename F> void TaskPool::run(F f) {
+    if (on_worker()) {
+        f();
+        return;
+    }
+    Task task(f, true);
+    push(static_cast<unsigned>(threads_.size()), &task);
+    {
+        std::unique_lock<std::mutex> lock(doneLock_);
+        while (!task.done.load(std::memory_order_acquire)) {
+            done_.wait(lock);
+        }
+    }
+    if (task.error) {
+        std::rethrow_exception(task.error);
+    }
+}
+
+/**
+ * Runs a and b, possibly in parallel, and returns when both are done. Outside
+ * of the pool's tasks it simply runs them one after the other.
+ */
+template <typename F1, typename F2> void TaskPool::fork_join(F1 a, F2 b) {
+    if (!on_worker()) {
+        a();
+        b();
+        return;
+    }
+    unsigned index = current_index();
+    Task task(b);
+    push(index, &task);
+    std::exception_ptr error;
+    try {
+        a();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    while (!task.done.load(std::memory_order_acquire)) {
+        // Usually b is still on top of our own deque. Otherwise it was
+        // stolen, so help out until the thief is done with it.
+        Task* next = pop(index);
+        if (next == nullptr) {
+            next = steal(index);
+        }
+        if (next != nullptr) {
+            execute(next);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (task.error) {
+        std::rethrow_exception(task.error);
+    }
+}
+
+inline void TaskPool::worker_loop(unsigned index) {
+    current_pool() = this;
+    current_index() = index;
+    while (true) {
+        Task* task = pop(index);
+        if (task == nullptr) {
+            task = steal(index);
+        }
+        if (task != nullptr) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepLock_);
+        if (stop_) {
+            return;
+        }
+        while (!stop_ && pending_.load() == 0) {
+            wake_.wait(lock);
+        }
+    }
+}
+
+inline void TaskPool::push(unsigned queue, Task* task) {
+    {
+        std::lock_guard<std::mutex> guard(queues_[queue]->lock);
+        queues_[queue]->tasks.push_back(task);
+    }
+    pending_.fetch_add(1);
+    // Taking the lock makes sure a worker that just found nothing to do is
+    // already waiting, so it can't miss the notification
+    { std::lock_guard<std::mutex> guard(sleepLock_); }
+    wake_.notify_one();
+}
+
+// Takes the newest task from a queue, or returns NULL
+inline TaskPool::Task* TaskPool::pop(unsigned queue) {
+    std::lock_guard<std::mutex> guard(queues_[queue]->lock);
+    std::deque<Task*>& tasks = queues_[queue]->tasks;
+    if (tasks.empty()) {
+        return nullptr;
+    }
+    Task* task = tasks.back();
+    tasks.pop_back();
+    pending_.fetch_sub(1);
+    return task;
+}
+
+// Takes the oldest task from some other queue, or returns NULL
+inline TaskPool::Task* TaskPool::steal(unsigned thief) {
+    for (std::size_t i = 1; i <= queues_.size(); i++) {
+        unsigned victim = static_cast<unsigned>((thief + i) % queues_.size());
+        std::lock_guard<std::mutex> guard(queues_[victim]->lock);
+        std::deque<Task*>& tasks = queues_[victim]->tasks;
+        if (!tasks.empty()) {
+            Task* task = tasks.front();
+            tasks.pop_front();
+            pending_.fetch_sub(1);
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+// Runs a task and marks it done. The task may be destroyed by its owner as
+// soon as it is marked done, so it isn't touched after that.
+inline void TaskPool::execute(Task* task) {
+    try {
+        task->fn();
+    } catch (...) {
+        task->error = std::current_exception();
+    }
+    if (task->external) {
+        std::lock_guard<std::mutex> guard(doneLock_);
+        task->done.store(true, std::memory_order_release);
+        done_.notify_all();
+    } else {
+        task->done.store(true, std::memory_order_release);
+    }
+}
+
+// Returns true if the calling thread is one of this pool's workers
+inline bool TaskPool::on_worker() const { return current_pool() == this; }
+
+inline TaskPool*& TaskPool::current_pool() {
+    static thread_local TaskPool* pool = nullptr;
+    return pool;
+}
+
+inline unsigned& TaskPool::current_index() {
+    static thread_local unsigned index = 0;
+    return index;
+}
+
+#endif
@@ -0,0 +1,478 @@
+#ifndef VEB_TREE_H
+#define VEB_TREE_H
+
+#include "avlbst.h"
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * A search tree compacted into one buffer in van Emde Boas order, which
+ * stays updatable.
+ *
+ * The van Emde Boas layout cuts the tree at half its height, stores the top
+ * half first and then each bottom subtree after it, and lays out every piece
+ * the same way recursively. Whatever the size of a cache line or page, a
+ * search crosses only O(log_B n) of them, without the layout knowing B.
+ * Nodes hold their key and 32-bit indexes of their children and of their
+ * item; the items themselves are kept in key order in a separate array.
+ *
+ * Removing a compacted key only marks it dead, and new keys go into an
+ * ordinary AVLTree on the side. When those changes add up to a quarter of
+ * the compacted items, everything is merged and compacted again, so the
+ * cost of compacting is spread over the updates that made it necessary.
+ */
+template <class Key, class Value> class VebTree {
+    // Keeps subtree sizes, so that size() is O(1) for maybe_compact
+    typedef AVLTree<Key, Value, std::less<Key>, true> Overflow;
+
+  public:
+    VebTree();
+    explicit VebTree(const BinarySearchTree<Key, Value>& tree);
+
+    void insert(const std::pair<const Key, Value>& new_item);
+    void remove(const Key& key);
+    void clear();
+    void compact();
+    bool empty() const;
+    std::size_t size() const;
+    std::size_t overflow_size() const;
+
+    /**
+     * Visits the items in key order, merging the compacted ones with the
+     * overflow tree.
+     */
+    class iterator {
+      public:
+        iterator();
+
+        std::pair<const Key, Value>& operator*() const;
+        std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+      private:
+        friend class VebTree<Key, Value>;
+        iterator(const VebTree<Key, Value>* tree, std::size_t item,
+                 typename Overflow::iterator overflow);
+        iterator(const VebTree<Key, Value>* tree, std::size_t item);
+        void skip_dead();
+        bool at_compacted() const;
+
+        const VebTree<Key, Value>* tree_;
+        std::size_t item_; // next compacted item
+        typename Overflow::iterator overflow_;
+        // At compacted item item_, with overflow_ not worked out yet. Saves
+        // a search of the overflow tree for lookups that never move on.
+        bool pending_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const& operator[](const Key& key) const;
+
+  private:
+    static const uint32_t NONE = 0xffffffff;
+
+    struct Slot {
+        Key key;
+        uint32_t left;
+        uint32_t right;
+        uint32_t item; // index into items_
+    };
+
+    void build(std::vector<std::pair<Key, Value> >& sorted);
+    std::size_t rank_slots(std::size_t pos, std::size_t rank,
+                           std::vector<uint32_t>& ranks) const;
+    void veb_order(std::size_t pos, int height,
+                   std::vector<uint32_t>& order) const;
+    std::size_t lower_bound_item(const Key& key) const;
+    std::size_t find_item(const Key& key) const;
+    void maybe_compact();
+
+    std::vector<Slot> slots_; // in van Emde Boas order, root first
+    // In key order. Mutable since, as with the other trees, iterators from a
+    // const tree still hand out items whose values can be changed.
+    mutable std::vector<std::pair<const Key, Value> > items_;
+    std::vector<char> live_; // live_[i] is 0 once items_[i] is removed
+    std::size_t dead_;
+    Overflow overflow_;
+};
+
+/*
+  ------------------------------------------------
+  Begin implementations for the VebTree class.
+  ------------------------------------------------
+*/
+
+template <class Key, class Value> VebTree<Key, Value>::VebTree() : dead_(0) {}
+
+/**
+ * Compacts a copy of the items of tree, e.g. an AVLTree. Takes O(n).
+ */
+template <class Key, class Value>
+VebTree<Key, Value>::VebTree(const BinarySearchTree<Key, Value>& tree)
+    : dead_(0) {
+    std::vector<std::pair<Key, Value> > sorted;
+    sorted.reserve(tree.size());
+    for (typename BinarySearchTree<Key, Value>::iterator it = tree.begin();
+         it != tree.end(); ++it) {
+        sorted.push_back(*it);
+    }
+    build(sorted);
+}
+
+/**
+ * Inserts or overwrites an item. A key that is, or was, compacted is updated
+ * in place; a new one goes to the overflow tree.
+ */
+template <class Key, class Value>
+void VebTree<Key, Value>::insert(const std::pair<const Key, Value>& new_item) {
+    std::size_t i = find_item(new_item.first);
+    if (i != items_.size()) {
+        items_[i].second = new_item.second;
+        if (!live_[i]) {
+            live_[i] = 1;
+            dead_--;
+        }
+        return;
+    }
+    overflow_.insert(new_item);
+    maybe_compact();
+}
+
+template <class Key, class Value>
+void VebTree<Key, Value>::remove(const Key& key) {
+    std::size_t i = find_item(key);
+    if (i != items_.size()) {
+        if (live_[i]) {
+            live_[i] = 0;
+            dead_++;
+            maybe_compact();
+        }
+        return;
+    }
+    overflow_.remove(key);
+}
+
+template <class Key, class Value> void VebTree<Key, Value>::clear() {
+    slots_.clear();
+    items_.clear();
+    live_.clear();
+    dead_ = 0;
+    overflow_.clear();
+}
+
+/**
+ * Merges the overflow tree into the compacted items, drops the removed ones
+ * and lays everything out again. Happens on its own as updates pile up.
+ */
+template <class Key, class Value> void VebTree<Key, Value>::compact() {
+    std::vector<std::pair<Key, Value> > sorted;
+    sorted.reserve(size());
+    typename Overflow::iterator extra = overflow_.begin();
+    for (std::size_t i = 0; i < items_.size(); i++) {
+        if (!live_[i]) {
+            continue;
+        }
+        while (extra != overflow_.end() && extra->first < items_[i].first) {
+            sorted.push_back(*extra);
+            ++extra;
+        }
+        sorted.push_back(items_[i]);
+    }
+    for (; extra != overflow_.end(); ++extra) {
+        sorted.push_back(*extra);
+    }
+    overflow_.clear();
+    build(sorted);
+}
+
+template <class Key, class Value> bool VebTree<Key, Value>::empty() const {
+    return size() == 0;
+}
+
+template <class Key, class Value>
+std::size_t VebTree<Key, Value>::size() const {
+    return items_.size() - dead_ + overflow_.size();
+}
+
+/**
+ * Returns the number of items inserted since the last compaction that
+ * haven't been compacted yet.
+ */
+template <class Key, class Value>
+std::size_t VebTree<Key, Value>::overflow_size() const {
+    return overflow_.size();
+}
+
+template <class Key, class Value>
+typename VebTree<Key, Value>::iterator VebTree<Key, Value>::begin() const {
+    return iterator(this, 0, overflow_.begin());
+}
+
+template <class Key, class Value>
+typename VebTree<Key, Value>::iterator VebTree<Key, Value>::end() const {
+    return iterator(this, items_.size(), overflow_.end());
+}
+
+/**
+ * Returns an iterator to the item with the given key, or end(). Looks in the
+ * compacted items first.
+ */
+template <class Key, class Value>
+typename VebTree<Key, Value>::iterator
+VebTree<Key, Value>::find(const Key& key) const {
+    std::size_t i = lower_bound_item(key);
+    if (i != items_.size() && !(key < items_[i].first)) {
+        if (!live_[i]) {
+            return end();
+        }
+        return iterator(this, i);
+    }
+    typename Overflow::iterator extra = overflow_.find(key);
+    if (extra == overflow_.end()) {
+        return end();
+    }
+    return iterator(this, i, extra);
+}
+
+/**
+ * Returns an iterator to the first item whose key is not less than key.
+ */
+template <class Key, class Value>
+typename VebTree<Key, Value>::iterator
+VebTree<Key, Value>::lower_bound(const Key& key) const {
+    return iterator(this, lower_bound_item(key), overflow_.lower_bound(key));
+}
+
+/**
+ * Throws std::out_of_range if the key isn't there.
+ */
+template <class Key, class Value>
+Value& VebTree<Key, Value>::operator[](const Key& key) {
+    iterator it = find(key);
+    if (it == end()) {
+        throw std::out_of_range("Invalid key");
+    }
+    return it->second;
+}
+
+template <class Key, class Value>
+Value const& VebTree<Key, Value>::operator[](const Key& key) const {
+    iterator it = find(key);
+    if (it == end()) {
+        throw std::out_of_range("Invalid key");
+    }
+    return it->second;
+}
+
+// Lays out the sorted items. The tree shape is the complete binary tree with
+// positions 1..n numbered breadth-first (children of k are 2k and 2k + 1),
+// which is perfectly balanced; only the order it is stored in changes.
+template <class Key, class Value>
+void VebTree<Key, Value>::build(std::vector<std::pair<Key, Value> >& sorted) {
+    const std::size_t n = sorted.size();
+    if (n >= NONE) {
+        throw std::length_error("Too many items for 32-bit indexes");
+    }
+    std::vector<std::pair<const Key, Value> > items(sorted.begin(),
+                                                    sorted.end());
+    items_.swap(items);
+    live_.assign(n, 1);
+    dead_ = 0;
+
+    int height = 0;
+    while ((std::size_t(1) << height) <= n) {
+        height++;
+    }
+    std::vector<uint32_t> ranks(n + 1);
+    rank_slots(1, 0, ranks);
+    std::vector<uint32_t> order; // positions in storage order
+    order.reserve(n);
+    veb_order(1, height, order);
+    std::vector<uint32_t> slotOf(n + 1);
+    for (std::size_t s = 0; s < n; s++) {
+        slotOf[order[s]] = static_cast<uint32_t>(s);
+    }
+
+    std::vector<Slot> slots;
+    slots.reserve(n);
+    for (std::size_t s = 0; s < n; s++) {
+        std::size_t pos = order[s];
+        Slot slot = {items_[ranks[pos]].first,
+                     2 * pos <= n ? slotOf[2 * pos] : NONE,
+                     2 * pos + 1 <= n ? slotOf[2 * pos + 1] : NONE,
+                     ranks[pos]};
+        slots.push_back(slot);
+    }
+    slots_.swap(slots);
+}
+
+// Assigns in-order ranks to the positions under pos, starting from rank, and
+// returns the next unused rank. Only recurses log n deep.
+template <class Key, class Value>
+std::size_t VebTree<Key, Value>::rank_slots(std::size_t pos, std::size_t rank,
+                                            std::vector<uint32_t>& ranks) const {
+    if (pos >= ranks.size()) {
+        return rank;
+    }
+    rank = rank_slots(2 * pos, rank, ranks);
+    ranks[pos] = static_cast<uint32_t>(rank++);
+    return rank_slots(2 * pos + 1, rank, ranks);
+}
+
+// Appends the positions of the subtree of the given height under pos in van
+// Emde Boas order: the top half of the levels, then each subtree hanging off
+// the bottom of it, left to right. Positions past the end are skipped.
+template <class Key, class Value>
+void VebTree<Key, Value>::veb_order(std::size_t pos, int height,
+                                    std::vector<uint32_t>& order) const {
+    if (pos > items_.size() || height == 0) {
+        return;
+    }
+    if (height == 1) {
+        order.push_back(static_cast<uint32_t>(pos));
+        return;
+    }
+    int top = height / 2;
+    int bottom = height - top;
+    veb_order(pos, top, order);
+    std::size_t first = pos << top;
+    for (std::size_t child = first; child < first + (std::size_t(1) << top);
+         child++) {
+        veb_order(child, bottom, order);
+    }
+}
+
+// Returns the index of the first compacted item whose key is not less than
+// key, dead or alive, or items_.size() if there's none
+template <class Key, class Value>
+std::size_t VebTree<Key, Value>::lower_bound_item(const Key& key) const {
+    std::size_t result = items_.size();
+    uint32_t s = slots_.empty() ? NONE : 0;
+    while (s != NONE) {
+        const Slot& slot = slots_[s];
+        if (slot.key < key) {
+            s = slot.right;
+        } else {
+            result = slot.item;
+            s = slot.left;
+        }
+    }
+    return result;
+}
+
+// Returns the index of the compacted item with the given key, dead or alive,
+// or items_.size() if there's none
+template <class Key, class Value>
+std::size_t VebTree<Key, Value>::find_item(const Key& key) const {
+    std::size_t i = lower_bound_item(key);
+    if (i != items_.size() && key < items_[i].first) {
+        return items_.size();
+    }
+    return i;
+}
+
+template <class Key, class Value> void VebTree<Key, Value>::maybe_compact() {
+    if (overflow_.size() + dead_ > items_.size() / 4 + 16) {
+        compact();
+    }
+}
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the VebTree::iterator class.
+  ------------------------------------------------------
+*/
+
+template <class Key, class Value>
+VebTree<Key, Value>::iterator::iterator()
+    : tree_(nullptr), item_(0), pending_(false) {}
+
+template <class Key, class Value>
+VebTree<Key, Value>::iterator::iterator(
+    const VebTree<Key, Value>* tree, std::size_t item,
+    typename Overflow::iterator overflow)
+    : tree_(tree), item_(item), overflow_(overflow), pending_(false) {
+    skip_dead();
+}
+
+// Points at the live compacted item at index item
+template <class Key, class Value>
+VebTree<Key, Value>::iterator::iterator(const VebTree<Key, Value>* tree,
+                                        std::size_t item)
+    : tree_(tree), item_(item), pending_(true) {}
+
+template <class Key, class Value>
+std::pair<const Key, Value>& VebTree<Key, Value>::iterator::operator*() const {
+    return at_compacted() ? tree_->items_[item_] : *overflow_;
+}
+
+template <class Key, class Value>
+std::pair<const Key, Value>* VebTree<Key, Value>::iterator::operator->() const {
+    return &**this;
+}
+
+template <class Key, class Value>
+bool VebTree<Key, Value>::iterator::operator==(const iterator& rhs) const {
+    if (item_ != rhs.item_) {
+        return false;
+    }
+    if (pending_ || rhs.pending_) {
+        return at_compacted() == rhs.at_compacted();
+    }
+    return overflow_ == rhs.overflow_;
+}
+
+template <class Key, class Value>
+bool VebTree<Key, Value>::iterator::operator!=(const iterator& rhs) const {
+    return !(*this == rhs);
+}
+
+template <class Key, class Value>
+typename VebTree<Key, Value>::iterator&
+VebTree<Key, Value>::iterator::operator++() {
+    if (pending_) {
+        overflow_ = tree_->overflow_.upper_bound(tree_->items_[item_].first);
+        pending_ = false;
+    }
+    if (at_compacted()) {
+        item_++;
+        skip_dead();
+    } else {
+        ++overflow_;
+    }
+    return *this;
+}
+
+template <class Key, class Value>
+void VebTree<Key, Value>::iterator::skip_dead() {
+    while (item_ < tree_->items_.size() && !tree_->live_[item_]) {
+        item_++;
+    }
+}
+
+// Returns true if the current item is a compacted one, i.e. the smaller of
+// the next compacted item and the next overflow item
+template <class Key, class Value>
+bool VebTree<Key, Value>::iterator::at_compacted() const {
+    if (pending_) {
+        return true;
+    }
+    if (item_ == tree_->items_.size()) {
+        return false;
+    }
+    return overflow_ == tree_->overflow_.end() ||
+           tree_->items_[item_].first < overflow_->first;
+}
+
+#endif